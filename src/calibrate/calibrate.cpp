@@ -0,0 +1,384 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "calibrate/calibrate.hpp"
+#include "compress/compress.hpp"
+#include "log/log.h"
+#include "parser/parser.hpp"
+#include "subprocess/subprocess.hpp"
+#include "walker/walker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/* how much of the target is compressed at every level */
+static constexpr size_t sample_size = 32 << 20;
+/* at most this much is read from any one file, so the sample spans many files */
+static constexpr size_t sample_per_file = 1 << 20;
+/* how much is written to destdir and encrypted with gpg */
+static constexpr size_t write_size = 64 << 20;
+/* destdir writes stop early after this many seconds */
+static constexpr double write_time_limit = 3;
+/* levels within this fraction of the fastest usable speed are considered equal */
+static constexpr double speed_tolerance = 0.05;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* compressed data is as good as random to everything after the compressor */
+static std::vector<char> random_data(size_t size) {
+  std::vector<char> data(size);
+  uint64_t x = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i + sizeof(x) <= size; i += sizeof(x)) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    std::memcpy(data.data() + i, &x, sizeof(x));
+  }
+  return data;
+}
+
+/* the start of as many files as fit, in directory order, out of what tar would archive */
+static std::vector<char> read_sample(Target &target) {
+  std::vector<char> sample;
+  Walker walker = target.make_walker();
+  walker.walk([&](const Walker::Entry &entry) {
+    if (!S_ISREG(entry.st.st_mode))
+      return;
+    int fd = openat(entry.dirfd, entry.name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NOATIME);
+    if (fd == -1)
+      fd = openat(entry.dirfd, entry.name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1)
+      return;
+    size_t want = std::min(sample_per_file, sample_size - sample.size());
+    size_t old_size = sample.size();
+    sample.resize(old_size + want);
+    ssize_t got = read(fd, sample.data() + old_size, want);
+    sample.resize(old_size + std::max<ssize_t>(got, 0));
+    close(fd);
+    if (sample.size() == sample_size)
+      walker.stop();
+  });
+  return sample;
+}
+
+/* feeds `input` to `process` on another thread, returns the seconds until it exited and the bytes it wrote */
+static bool run_measured(Subprocess &process, const std::vector<char> &input, double &seconds, uint64_t &output_bytes) {
+  int in_pipefds[2];
+  int out_pipefds[2];
+  if (pipe2(in_pipefds, O_CLOEXEC) == -1 || pipe2(out_pipefds, O_CLOEXEC) == -1)
+    return false;
+  process.redirect(in_pipefds[0], 0);
+  process.redirect(out_pipefds[1], 1);
+
+  auto start = std::chrono::steady_clock::now();
+  bool failed = process.run();
+  close(in_pipefds[0]);
+  close(out_pipefds[1]);
+  if (failed) {
+    close(in_pipefds[1]);
+    close(out_pipefds[0]);
+    return false;
+  }
+
+  std::thread writer([&]() {
+    for (size_t written = 0; written < input.size();) {
+      ssize_t ret = write(in_pipefds[1], input.data() + written, input.size() - written);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1)
+        break;
+      written += ret;
+    }
+    close(in_pipefds[1]);
+  });
+
+  char buffer[1 << 16];
+  output_bytes = 0;
+  for (;;) {
+    ssize_t got = read(out_pipefds[0], buffer, sizeof(buffer));
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    output_bytes += got;
+  }
+  close(out_pipefds[0]);
+  writer.join();
+  int code = process.join();
+  seconds = seconds_since(start);
+  return code == 0;
+}
+
+static double measure_write_speed(const fs::path &destdir) {
+  std::error_code ec;
+  fs::create_directories(destdir, ec);
+  std::string tmp = (destdir / ".backman-calibrate-XXXXXX").string();
+  int fd = mkostemp(tmp.data(), O_CLOEXEC);
+  if (fd == -1) {
+    Logger::logf(Logger::WARN, "can't write to \"%s\" to measure it", destdir.c_str());
+    return 0;
+  }
+  unlink(tmp.c_str());
+
+  std::vector<char> data = random_data(1 << 20);
+  auto start = std::chrono::steady_clock::now();
+  size_t written = 0;
+  while (written < write_size && seconds_since(start) < write_time_limit) {
+    ssize_t ret = write(fd, data.data(), data.size());
+    if (ret <= 0)
+      break;
+    written += ret;
+  }
+  /* the page cache would make any disk look fast */
+  fdatasync(fd);
+  double seconds = seconds_since(start);
+  close(fd);
+  return seconds > 0 ? written / seconds : 0;
+}
+
+static double measure_gpg_speed() {
+  Subprocess gpg;
+  if (!gpg.set_executable("gpg"))
+    return 0;
+  int passphrase_pipefds[2];
+  if (pipe2(passphrase_pipefds, O_CLOEXEC) == -1)
+    return 0;
+  for (const char *arg : {"--batch", "--yes", "--pinentry-mode", "loopback", "--passphrase-fd", "3",
+                          "--symmetric", "--cipher-algo", "AES256", "--compress-algo", "none", "-o", "-"}) {
+    gpg.add_argument(arg);
+  }
+  gpg.redirect(passphrase_pipefds[0], 3);
+  write(passphrase_pipefds[1], "calibration\n", 12);
+  close(passphrase_pipefds[1]);
+
+  std::vector<char> data = random_data(write_size / 2);
+  double seconds = 0;
+  uint64_t output = 0;
+  bool ok = run_measured(gpg, data, seconds, output);
+  close(passphrase_pipefds[0]);
+  return ok && seconds > 0 ? data.size() / seconds : 0;
+}
+
+static std::vector<int> levels_to_try(Compressor::Family family) {
+  switch (family) {
+    case Compressor::ZSTD:  return {1, 3, 6, 9, 12, 15, 19};
+    case Compressor::XZ:    return {0, 1, 3, 6, 9};
+    case Compressor::GZIP:
+    case Compressor::PIGZ:
+    case Compressor::BZIP2: return {1, 3, 6, 9};
+    case Compressor::LZ4:   return {1, 9};
+    default:                return {};
+  }
+}
+
+Calibration::Result Calibration::calibrate(Target &target) {
+  Result result;
+  result.target = target.get_name();
+  result.compress_program = target.get_compress_program();
+  result.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  Logger::logf(Logger::INFO, "measuring writes to \"%s\"", target.get_destdir().c_str());
+  result.write_speed = measure_write_speed(target.get_destdir());
+  if (target.is_encrypted()) {
+    Logger::log(Logger::INFO, "measuring gpg");
+    result.gpg_speed = measure_gpg_speed();
+  }
+
+  std::vector<char> sample = read_sample(target);
+  if (sample.empty()) {
+    Logger::logf(Logger::WARN, "nothing readable in \"%s\" to sample", target.get_path().c_str());
+    return result;
+  }
+
+  Compressor base{result.compress_program};
+  for (int level : levels_to_try(base.get_family())) {
+    Compressor compress{result.compress_program};
+    compress.set_level(level);
+    compress.set_threads(result.threads);
+    Subprocess process;
+    if (compress.setup(process)) {
+      Logger::logf(Logger::WARN, "can't run \"%s\"", compress.get_command().c_str());
+      break;
+    }
+    double seconds = 0;
+    uint64_t output = 0;
+    if (!run_measured(process, sample, seconds, output) || output == 0 || seconds <= 0) {
+      Logger::logf(Logger::WARN, "\"%s\" failed", compress.get_command().c_str());
+      continue;
+    }
+    Level measured;
+    measured.level = level;
+    measured.speed = sample.size() / seconds;
+    measured.ratio = (double)sample.size() / output;
+    result.levels.push_back(measured);
+    Logger::logf(Logger::INFO, "level %d: %.1f MB/s, ratio %.2f", level, measured.speed / 1e6, measured.ratio);
+  }
+  return result;
+}
+
+bool Calibration::choose(const Result &result, int &level, int &threads) {
+  if (result.levels.empty())
+    return false;
+
+  /* how fast the uncompressed stream can go at a level, ignoring the compressor itself */
+  auto downstream = [&](const Level &l) {
+    double speed = std::numeric_limits<double>::infinity();
+    if (result.write_speed > 0)
+      speed = std::min(speed, result.write_speed * l.ratio);
+    if (result.gpg_speed > 0)
+      speed = std::min(speed, result.gpg_speed * l.ratio);
+    return speed;
+  };
+
+  double best_speed = 0;
+  for (const Level &l : result.levels)
+    best_speed = std::max(best_speed, std::min(l.speed, downstream(l)));
+
+  const Level *chosen = NULL;
+  for (const Level &l : result.levels) {
+    if (std::min(l.speed, downstream(l)) < best_speed * (1 - speed_tolerance))
+      continue;
+    if (chosen == NULL || l.ratio > chosen->ratio)
+      chosen = &l;
+  }
+
+  level = chosen->level;
+  /* only as many threads as it takes to keep up with the destination */
+  threads = result.threads;
+  double needed = downstream(*chosen);
+  if (needed < chosen->speed) {
+    double share = result.threads * needed / chosen->speed;
+    threads = std::clamp((int)share + (share > (int)share), 1, result.threads);
+  }
+  return true;
+}
+
+Calibration::Store::Store(fs::path directory) {
+  char hostname[256] = "localhost";
+  gethostname(hostname, sizeof(hostname) - 1);
+  this->path = directory / ("calibration-" + std::string(hostname) + ".ini");
+}
+
+void Calibration::Store::load() {
+  this->results.clear();
+  if (!fs::exists(this->path))
+    return;
+  INI_Parser::INI_Data data;
+  try {
+    data = INI_Parser::ini_parse(this->path);
+  } catch (std::exception &e) {
+    Logger::logf(Logger::WARN, "can't read calibration \"%s\": %s", this->path.c_str(), e.what());
+    return;
+  }
+  for (INI_Parser::INI_Section &section : data) {
+    if (section.get_section_name() != "calibration" || section["target"].size() != 1)
+      continue;
+    Result result;
+    result.target = section["target"][0];
+    try {
+      if (section["compress_program"].size() == 1)
+        result.compress_program = section["compress_program"][0];
+      if (section["threads"].size() == 1)
+        result.threads = std::stoi(section["threads"][0]);
+      if (section["write_speed"].size() == 1)
+        result.write_speed = std::stod(section["write_speed"][0]);
+      if (section["gpg_speed"].size() == 1)
+        result.gpg_speed = std::stod(section["gpg_speed"][0]);
+      /* level = <level>:<speed>:<ratio> */
+      for (const std::string &value : section["level"]) {
+        Level l;
+        if (std::sscanf(value.c_str(), "%d:%lf:%lf", &l.level, &l.speed, &l.ratio) == 3)
+          result.levels.push_back(l);
+      }
+    } catch (...) {
+      Logger::logf(Logger::WARN, "ignoring malformed calibration of \"%s\"", result.target.c_str());
+      continue;
+    }
+    this->results.push_back(result);
+  }
+}
+
+void Calibration::Store::set(const Result &result) {
+  for (Result &existing : this->results) {
+    if (existing.target == result.target) {
+      existing = result;
+      return;
+    }
+  }
+  this->results.push_back(result);
+}
+
+bool Calibration::Store::save() {
+  std::error_code ec;
+  fs::create_directories(this->path.parent_path(), ec);
+  fs::path tmp_path = this->path;
+  tmp_path += ".tmp";
+  FILE *file = fopen(tmp_path.c_str(), "w");
+  if (file == NULL) {
+    Logger::logf(Logger::WARN, "can't write calibration \"%s\"", this->path.c_str());
+    return false;
+  }
+  fprintf(file, "# written by backman --calibrate\n");
+  for (const Result &result : this->results) {
+    fprintf(file,
+            "\n[calibration]\n"
+            "target = \"%s\"\n"
+            "compress_program = \"%s\"\n"
+            "threads = %d\n"
+            "write_speed = %.0f\n"
+            "gpg_speed = %.0f\n",
+            result.target.c_str(), result.compress_program.c_str(), result.threads,
+            result.write_speed, result.gpg_speed);
+    for (const Level &l : result.levels)
+      fprintf(file, "level = %d:%.0f:%.4f\n", l.level, l.speed, l.ratio);
+  }
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+  ok = ok && rename(tmp_path.c_str(), this->path.c_str()) == 0;
+  if (!ok)
+    Logger::logf(Logger::WARN, "can't write calibration \"%s\"", this->path.c_str());
+  return ok;
+}
+
+Calibration::Result *Calibration::Store::get(const std::string &target) {
+  for (Result &result : this->results) {
+    if (result.target == target)
+      return &result;
+  }
+  return NULL;
+}
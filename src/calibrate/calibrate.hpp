@@ -0,0 +1,75 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "target/target.hpp"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Calibration {
+
+  struct Level {
+    int    level = 0;
+    double speed = 0; /* uncompressed bytes per second */
+    double ratio = 1; /* uncompressed / compressed */
+  };
+
+  /* what the compressor, gpg and destination of one target can sustain on this host */
+  struct Result {
+    std::string        target;
+    std::string        compress_program; /* the command the levels were measured with */
+    int                threads     = 1;
+    double             write_speed = 0; /* bytes per second to destdir */
+    double             gpg_speed   = 0; /* bytes per second, 0 if the target isn't encrypted */
+    std::vector<Level> levels;
+  };
+
+  /* writes a test file to the target's destdir, and runs gpg and every level of the */
+  /* compressor on a sample of the target's files, takes a few seconds per target */
+  Result calibrate(Target &target);
+
+  /* the level and thread count at which the slowest of compressor, gpg and destination */
+  /* is as fast as possible, preferring better ratios among near equals */
+  /* returns false if the result has no levels */
+  bool choose(const Result &result, int &level, int &threads);
+
+  /* calibration-<hostname>.ini in the state directory */
+  class Store {
+    public:
+    Store(std::filesystem::path directory);
+
+    void   load();
+    void   set(const Result &result);
+    bool   save();
+    /* NULL if the target was never calibrated on this host */
+    Result *get(const std::string &target);
+
+    private:
+    std::filesystem::path path;
+    std::vector<Result>   results;
+  };
+
+}
@@ -0,0 +1,433 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "catalog/catalog.hpp"
+#include "exclude/exclude.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char catalog_magic[] = "BACKMAN-CAT1\n";
+/* the magic, then the counts of runs, paths and blocks and the offsets of the */
+/* runs, the paths and the block index */
+static constexpr size_t header_size = sizeof(catalog_magic) - 1 + 4 + 5 * 8;
+/* a version's last run isn't the one before for runs of no target */
+static constexpr uint32_t no_run = UINT32_MAX;
+
+namespace {
+
+/* buffered, with the integers little endian or as LEB128 varints */
+class Writer {
+  public:
+  uint64_t offset = 0;
+  bool     failed = false;
+
+  explicit Writer(FILE *file) : file(file) {}
+
+  void bytes(const void *data, size_t length) {
+    if (length > 0 && fwrite(data, 1, length, this->file) != length)
+      this->failed = true;
+    this->offset += length;
+  }
+  void u32(uint32_t value) {
+    unsigned char data[4];
+    for (int i = 0; i < 4; i++)
+      data[i] = value >> (8 * i);
+    this->bytes(data, 4);
+  }
+  void u64(uint64_t value) {
+    unsigned char data[8];
+    for (int i = 0; i < 8; i++)
+      data[i] = value >> (8 * i);
+    this->bytes(data, 8);
+  }
+  void str(const std::string &value) {
+    this->u32(value.size());
+    this->bytes(value.data(), value.size());
+  }
+  void varint(uint64_t value) {
+    unsigned char data[10];
+    size_t length = 0;
+    do {
+      data[length] = value & 0x7f;
+      value >>= 7;
+      if (value)
+        data[length] |= 0x80;
+      length++;
+    } while (value);
+    this->bytes(data, length);
+  }
+
+  private:
+  FILE *file;
+};
+
+/* the other side of Writer over the mapping, every read fails past `end` */
+struct Reader {
+  const unsigned char *position;
+  const unsigned char *end;
+
+  bool u32(uint32_t &value) {
+    if (this->end - this->position < 4)
+      return false;
+    value = 0;
+    for (int i = 0; i < 4; i++)
+      value |= (uint32_t)*this->position++ << (8 * i);
+    return true;
+  }
+  bool u64(uint64_t &value) {
+    if (this->end - this->position < 8)
+      return false;
+    value = 0;
+    for (int i = 0; i < 8; i++)
+      value |= (uint64_t)*this->position++ << (8 * i);
+    return true;
+  }
+  bool str(std::string &value) {
+    uint32_t length;
+    if (!this->u32(length) || (size_t)(this->end - this->position) < length)
+      return false;
+    value.assign((const char *)this->position, length);
+    this->position += length;
+    return true;
+  }
+  bool varint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (this->position == this->end)
+        return false;
+      unsigned char byte = *this->position++;
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+};
+
+} // namespace
+
+static uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+
+static int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+static void write_entry(Writer &out, const std::string &previous, const std::string &path,
+                        const std::vector<Catalog::Version> &versions, bool block_start) {
+  size_t shared = 0;
+  if (!block_start) {
+    size_t limit = std::min(previous.size(), path.size());
+    while (shared < limit && previous[shared] == path[shared])
+      shared++;
+  }
+  out.varint(shared);
+  out.varint(path.size() - shared);
+  out.bytes(path.data() + shared, path.size() - shared);
+  out.varint(versions.size());
+  for (const Catalog::Version &version : versions) {
+    out.varint(version.first);
+    out.varint(version.last - version.first);
+    out.varint(zigzag(version.mtime));
+    out.varint(version.size);
+    out.varint(version.mode);
+  }
+}
+
+Catalog::Catalog(const fs::path &path) : path(path) {}
+
+Catalog::~Catalog() {
+  if (this->data != NULL)
+    munmap((void *)this->data, this->length);
+}
+
+bool Catalog::load() {
+  int fd = open(this->path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < header_size) {
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+  this->data = (const unsigned char *)mapping;
+  this->length = st.st_size;
+
+  Reader in{this->data + sizeof(catalog_magic) - 1, this->data + this->length};
+  uint32_t run_count;
+  uint64_t runs_offset, paths_offset, index_offset;
+  bool ok = std::memcmp(this->data, catalog_magic, sizeof(catalog_magic) - 1) == 0 &&
+            in.u32(run_count) && in.u64(this->path_count) && in.u64(this->block_count) &&
+            in.u64(runs_offset) && in.u64(paths_offset) && in.u64(index_offset) &&
+            runs_offset <= this->length && paths_offset <= this->length &&
+            index_offset <= this->length &&
+            this->block_count == (this->path_count + block_entries - 1) / block_entries &&
+            (this->length - index_offset) / 8 >= this->block_count;
+  in.position = this->data + (ok ? runs_offset : 0);
+  for (uint32_t i = 0; ok && i < run_count; i++) {
+    Run run;
+    uint64_t time;
+    ok = in.str(run.target) && in.str(run.archive) && in.u64(time);
+    run.time = time;
+    this->runs.push_back(run);
+  }
+  if (!ok) {
+    Logger::logf(Logger::WARN, "the catalog \"%s\" is damaged", this->path.c_str());
+    this->runs.clear();
+    this->path_count = 0;
+    this->block_count = 0;
+    return false;
+  }
+  this->index = this->data + index_offset;
+  return true;
+}
+
+const std::vector<Catalog::Run> &Catalog::get_runs() { return this->runs; }
+
+uint64_t Catalog::block_offset(uint64_t block) const {
+  uint64_t offset = 0;
+  for (int i = 0; i < 8; i++)
+    offset |= (uint64_t)this->index[block * 8 + i] << (8 * i);
+  return std::min<uint64_t>(offset, this->length);
+}
+
+Catalog::Cursor::Cursor(const Catalog &catalog, uint64_t block)
+    : catalog(catalog), entry(block * block_entries) {
+  this->position = block < catalog.block_count ? catalog.data + catalog.block_offset(block)
+                                               : catalog.data + catalog.length;
+}
+
+bool Catalog::Cursor::next(std::string &path, std::vector<Version> &versions) {
+  if (this->entry >= this->catalog.path_count)
+    return false;
+  Reader in{this->position, this->catalog.data + this->catalog.length};
+  uint64_t shared, suffix, count;
+  if (!in.varint(shared) || !in.varint(suffix) || shared > this->previous.size() ||
+      (uint64_t)(in.end - in.position) < suffix)
+    return false;
+  this->previous.resize(shared);
+  this->previous.append((const char *)in.position, suffix);
+  in.position += suffix;
+  if (!in.varint(count) || count > (uint64_t)(in.end - in.position))
+    return false;
+  versions.resize(count);
+  for (Version &version : versions) {
+    uint64_t first, span, mtime, size, mode;
+    if (!in.varint(first) || !in.varint(span) || !in.varint(mtime) || !in.varint(size) ||
+        !in.varint(mode))
+      return false;
+    version = {(uint32_t)first, (uint32_t)(first + span), unzigzag(mtime), size, (uint32_t)mode};
+  }
+  this->position = in.position;
+  this->entry++;
+  path = this->previous;
+  return true;
+}
+
+uint64_t Catalog::find_block(const std::string &path) const {
+  /* the first entry of a block is stored whole */
+  uint64_t low = 0;
+  uint64_t high = this->block_count;
+  std::string first;
+  std::vector<Version> versions;
+  while (high - low > 1) {
+    uint64_t middle = low + (high - low) / 2;
+    Cursor cursor{*this, middle};
+    if (!cursor.next(first, versions) || first > path)
+      high = middle;
+    else
+      low = middle;
+  }
+  return low;
+}
+
+void Catalog::find(const std::string &pattern,
+                   const std::function<void(const std::string &, const std::vector<Version> &)> &found) {
+  ExcludeMatcher matcher{{pattern}};
+  /* a pattern from the root only needs the paths under its literal start */
+  std::string prefix;
+  if (!pattern.empty() && pattern[0] == '/')
+    prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+  Cursor cursor{*this, prefix.empty() ? 0 : this->find_block(prefix)};
+  std::string path;
+  std::vector<Version> versions;
+  while (cursor.next(path, versions)) {
+    if (path.compare(0, prefix.size(), prefix) > 0)
+      break;
+    if (path.compare(0, prefix.size(), prefix) == 0 && matcher.matches(path))
+      found(path, versions);
+  }
+}
+
+std::vector<Catalog::Version> Catalog::history(const std::string &path) {
+  Cursor cursor{*this, this->find_block(path)};
+  std::string found;
+  std::vector<Version> versions;
+  while (cursor.next(found, versions)) {
+    if (found == path)
+      return versions;
+    if (found > path)
+      break;
+  }
+  return {};
+}
+
+bool Catalog::add_run(const fs::path &path, const Run &run, std::vector<Member> members) {
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  fs::path lock_path = path;
+  lock_path += ".lock";
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+    Logger::logf(Logger::WARN, "can't lock the catalog \"%s\"", lock_path.c_str());
+    if (lock_fd != -1)
+      close(lock_fd);
+    return false;
+  }
+
+  Catalog old{path};
+  if (!old.load() && fs::exists(path, ec))
+    Logger::logf(Logger::WARN, "starting a new catalog in place of \"%s\"", path.c_str());
+  uint32_t id = old.runs.size();
+  /* a version that lasted until the target's last run may go on into this one */
+  uint32_t previous_run = no_run;
+  for (uint32_t i = 0; i < old.runs.size(); i++) {
+    if (old.runs[i].target == run.target)
+      previous_run = i;
+  }
+
+  std::sort(members.begin(), members.end(),
+            [](const Member &a, const Member &b) { return a.path < b.path; });
+  members.erase(std::unique(members.begin(), members.end(),
+                            [](const Member &a, const Member &b) { return a.path == b.path; }),
+                members.end());
+
+  fs::path temporary = path;
+  temporary += ".tmp";
+  FILE *file = fopen(temporary.c_str(), "w");
+  if (file == NULL) {
+    Logger::logf(Logger::WARN, "can't write \"%s\": %s", temporary.c_str(), strerror(errno));
+    close(lock_fd);
+    return false;
+  }
+  Writer out{file};
+  /* the header is written again once the offsets are known */
+  std::vector<char> header(header_size);
+  out.bytes(header.data(), header.size());
+  uint64_t runs_offset = out.offset;
+  for (const Run &existing : old.runs) {
+    out.str(existing.target);
+    out.str(existing.archive);
+    out.u64(existing.time);
+  }
+  out.str(run.target);
+  out.str(run.archive);
+  out.u64(run.time);
+
+  /* both sorted, so one pass merges them */
+  uint64_t paths_offset = out.offset;
+  std::vector<uint64_t> blocks;
+  uint64_t count = 0;
+  std::string previous;
+  auto emit = [&](const std::string &entry_path, const std::vector<Version> &versions) {
+    bool block_start = count % block_entries == 0;
+    if (block_start)
+      blocks.push_back(out.offset);
+    write_entry(out, previous, entry_path, versions, block_start);
+    previous = entry_path;
+    count++;
+  };
+  Cursor cursor{old, 0};
+  std::string old_path;
+  std::vector<Version> old_versions;
+  std::vector<Version> versions;
+  uint64_t read = 0;
+  bool more = cursor.next(old_path, old_versions);
+  size_t next = 0;
+  while (more || next < members.size()) {
+    int order = !more ? 1 : next == members.size() ? -1 : old_path.compare(members[next].path);
+    if (order < 0) {
+      emit(old_path, old_versions);
+      read++;
+      more = cursor.next(old_path, old_versions);
+      continue;
+    }
+    const Member &member = members[next++];
+    versions.clear();
+    if (order == 0)
+      versions.swap(old_versions);
+    Version *last = versions.empty() ? NULL : &versions.back();
+    if (last != NULL && last->last == previous_run && last->mtime == member.mtime &&
+        last->size == member.size && last->mode == member.mode)
+      last->last = id;
+    else
+      versions.push_back({id, id, member.mtime, member.size, member.mode});
+    emit(member.path, versions);
+    if (order == 0) {
+      read++;
+      more = cursor.next(old_path, old_versions);
+    }
+  }
+  if (read < old.path_count)
+    Logger::log(Logger::WARN, "the catalog was damaged, the paths after the damage are lost");
+
+  uint64_t index_offset = out.offset;
+  for (uint64_t block : blocks)
+    out.u64(block);
+
+  bool ok = fflush(file) == 0 && !out.failed && fseek(file, 0, SEEK_SET) == 0;
+  if (ok) {
+    Writer head{file};
+    head.bytes(catalog_magic, sizeof(catalog_magic) - 1);
+    head.u32(old.runs.size() + 1);
+    head.u64(count);
+    head.u64(blocks.size());
+    head.u64(runs_offset);
+    head.u64(paths_offset);
+    head.u64(index_offset);
+    ok = !head.failed && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  }
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(temporary.c_str(), path.c_str()) == -1) {
+    Logger::logf(Logger::WARN, "can't write the catalog \"%s\": %s", path.c_str(), strerror(errno));
+    unlink(temporary.c_str());
+    close(lock_fd);
+    return false;
+  }
+  close(lock_fd);
+  Logger::logf(Logger::DEBUG, "cataloged %zu files, %llu paths in the catalog", members.size(),
+               (unsigned long long)count);
+  return true;
+}
@@ -0,0 +1,110 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* every file of every archive backman made, so finding the archive holding a file */
+/* (or an older version of it) doesn't mean decrypting and decompressing them all */
+/* the paths are sorted and front coded in blocks of block_entries, with an index of */
+/* the blocks to binary search; each path has the ranges of runs it was in unchanged, */
+/* so a file that never changes costs nothing per run. The file is mapped, not read */
+class Catalog {
+  public:
+  static constexpr size_t block_entries = 16;
+
+  /* what a run archived, as the walk saw it */
+  struct Member {
+    std::string path;
+    int64_t     mtime;
+    uint64_t    size;
+    uint32_t    mode;
+  };
+  /* one run of a target, `archive` is its archive (or manifest when sharded) */
+  struct Run {
+    std::string target;
+    std::string archive;
+    int64_t     time;
+  };
+  /* the file was the same in the runs first to last of the target that made first */
+  struct Version {
+    uint32_t first;
+    uint32_t last;
+    int64_t  mtime;
+    uint64_t size;
+    uint32_t mode;
+  };
+
+  explicit Catalog(const std::filesystem::path &path);
+  ~Catalog();
+
+  Catalog(const Catalog &) = delete;
+  Catalog &operator=(const Catalog &) = delete;
+
+  /* maps the catalog, false if there's none yet or it's damaged */
+  bool                    load();
+  const std::vector<Run> &get_runs();
+  /* calls `found` for every path matching `pattern`, as excludes match */
+  void                    find(const std::string &pattern,
+                               const std::function<void(const std::string &, const std::vector<Version> &)> &found);
+  /* the versions of `path`, oldest first, empty if it was never archived */
+  std::vector<Version>    history(const std::string &path);
+
+  /* merges the run into the catalog at `path`, other backman processes may do the */
+  /* same at once */
+  static bool add_run(const std::filesystem::path &path, const Run &run, std::vector<Member> members);
+
+  private:
+  std::filesystem::path path;
+  const unsigned char  *data = NULL;
+  size_t                length = 0;
+  std::vector<Run>      runs;
+  uint64_t              path_count = 0;
+  uint64_t              block_count = 0;
+  const unsigned char  *index = NULL;
+
+  /* decodes the entries of a block on, sequentially */
+  class Cursor {
+    public:
+    Cursor(const Catalog &catalog, uint64_t block);
+    /* false at the end of the catalog or if it's damaged */
+    bool next(std::string &path, std::vector<Version> &versions);
+
+    private:
+    const Catalog       &catalog;
+    const unsigned char *position;
+    uint64_t             entry;
+    /* the entries are front coded against the one before */
+    std::string          previous;
+  };
+
+  uint64_t block_offset(uint64_t block) const;
+  /* the first path of the last block starting at or before `path` */
+  uint64_t find_block(const std::string &path) const;
+};
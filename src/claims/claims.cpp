@@ -0,0 +1,70 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "claims/claims.hpp"
+
+bool InodeClaims::parse_mode(const std::string &name, Mode &mode) {
+  if (name == "none")
+    mode = NONE;
+  else if (name == "report")
+    mode = REPORT;
+  else if (name == "skip")
+    mode = SKIP;
+  else
+    return false;
+  return true;
+}
+
+InodeClaims::InodeClaims(Mode mode) : mode(mode) {}
+
+InodeClaims::Mode InodeClaims::get_mode() {
+  return this->mode;
+}
+
+unsigned InodeClaims::add_owner(const std::string &name) {
+  std::lock_guard<std::mutex> guard{this->names_lock};
+  this->names.push_back(name);
+  return this->names.size() - 1;
+}
+
+std::string InodeClaims::get_owner_name(unsigned owner) {
+  std::lock_guard<std::mutex> guard{this->names_lock};
+  return owner < this->names.size() ? this->names[owner] : std::string();
+}
+
+size_t InodeClaims::KeyHash::operator()(const Key &key) const {
+  /* inode numbers are mostly sequential, mix them so the shards fill evenly */
+  uint64_t h = (uint64_t)key.ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)key.dev;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  return h ^ (h >> 32);
+}
+
+unsigned InodeClaims::claim(dev_t dev, ino_t ino, unsigned owner) {
+  Key key{dev, ino};
+  size_t hash = KeyHash{}(key);
+  /* the map hashes the low bits, the shard is picked with the high ones */
+  Shard &shard = this->shards[(hash >> 58) % shard_count];
+  std::lock_guard<std::mutex> guard{shard.lock};
+  return shard.owners.try_emplace(key, owner).first->second;
+}
@@ -0,0 +1,76 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/* which target of this run archives each inode, so content reachable from */
+/* several targets (overlapping paths, hard links between their trees) is noticed */
+/* shared by every target, which may walk at the same time */
+class InodeClaims {
+  public:
+  enum Mode {
+    NONE,   /* not tracked */
+    REPORT, /* archived by every target that reaches it, and logged */
+    SKIP,   /* archived by the first target to reach it, left out of the rest */
+  };
+
+  static bool parse_mode(const std::string &name, Mode &mode);
+
+  explicit InodeClaims(Mode mode);
+
+  Mode get_mode();
+  /* the id a target claims with */
+  unsigned add_owner(const std::string &name);
+  std::string get_owner_name(unsigned owner);
+  /* claims the inode for `owner` unless it was already, returns the owner it has */
+  unsigned claim(dev_t dev, ino_t ino, unsigned owner);
+
+  private:
+  struct Key {
+    dev_t dev;
+    ino_t ino;
+    bool operator==(const Key &other) const { return dev == other.dev && ino == other.ino; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+  /* locked separately so targets walking together rarely wait on each other */
+  struct Shard {
+    std::mutex                                  lock;
+    std::unordered_map<Key, unsigned, KeyHash>  owners;
+  };
+  static constexpr size_t shard_count = 64;
+
+  Mode                             mode;
+  std::mutex                       names_lock;
+  std::vector<std::string>         names;
+  std::array<Shard, shard_count>   shards;
+};
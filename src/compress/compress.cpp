@@ -0,0 +1,253 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "compress/compress.hpp"
+
+#include <cctype>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+static bool is_level_flag(const std::string &token) {
+  if (token.size() < 2 || token[0] != '-' || token[1] == '-')
+    return false;
+  for (size_t i = 1; i < token.size(); i++) {
+    if (!std::isdigit(static_cast<unsigned char>(token[i])))
+      return false;
+  }
+  return true;
+}
+
+static bool starts_with(const std::string &str, const std::string &prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+std::vector<std::string> Compressor::split_command(const std::string &command) {
+  std::vector<std::string> tokens;
+  std::string current;
+  bool in_token = false;
+  char quote = 0;
+  for (size_t i = 0; i < command.size(); i++) {
+    char c = command[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (c == '\\' && quote == '"' && i + 1 < command.size())
+        current += command[++i];
+      else
+        current += c;
+      continue;
+    }
+    if (c == '\'' || c == '"') {
+      quote = c;
+      in_token = true;
+    } else if (c == '\\' && i + 1 < command.size()) {
+      current += command[++i];
+      in_token = true;
+    } else if (std::isspace(static_cast<unsigned char>(c))) {
+      if (in_token)
+        tokens.push_back(current);
+      current.clear();
+      in_token = false;
+    } else {
+      current += c;
+      in_token = true;
+    }
+  }
+  if (in_token)
+    tokens.push_back(current);
+  return tokens;
+}
+
+Compressor::Compressor(const std::string &command) {
+  this->tokens = Compressor::split_command(command);
+  if (this->tokens.empty())
+    return;
+
+  std::string name = std::filesystem::path(this->tokens[0]).filename();
+  if (name == "zstd" || name == "zstdmt")
+    this->family = ZSTD;
+  else if (name == "xz")
+    this->family = XZ;
+  else if (name == "gzip")
+    this->family = GZIP;
+  else if (name == "pigz")
+    this->family = PIGZ;
+  else if (name == "bzip2" || name == "lbzip2" || name == "pbzip2")
+    this->family = BZIP2;
+  else if (name == "lz4")
+    this->family = LZ4;
+}
+
+Compressor::Family Compressor::get_family() { return this->family; }
+
+template <typename Pred>
+void Compressor::remove_tokens(Pred matches, bool takes_value) {
+  for (size_t i = 1; i < this->tokens.size(); i++) {
+    if (!matches(this->tokens[i]))
+      continue;
+    size_t count = takes_value && i + 1 < this->tokens.size() ? 2 : 1;
+    this->tokens.erase(this->tokens.begin() + i, this->tokens.begin() + i + count);
+    i--;
+  }
+}
+
+bool Compressor::set_level(int level) {
+  switch (this->family) {
+    case ZSTD:
+      this->remove_tokens([](const std::string &t) {
+        return is_level_flag(t) || t == "--ultra" || t == "--adapt" ||
+               starts_with(t, "--adapt=") || t == "--fast" || starts_with(t, "--fast=");
+      });
+      if (level > 19)
+        this->tokens.push_back("--ultra");
+      break;
+    case XZ:
+      this->remove_tokens([](const std::string &t) {
+        return is_level_flag(t) || (t.size() == 3 && t[0] == '-' && std::isdigit(static_cast<unsigned char>(t[1])) && t[2] == 'e') ||
+               t == "-e" || t == "--extreme" || starts_with(t, "--preset=");
+      });
+      break;
+    case GZIP:
+    case PIGZ:
+    case BZIP2:
+    case LZ4:
+      this->remove_tokens([](const std::string &t) {
+        return is_level_flag(t) || t == "--fast" || t == "--best";
+      });
+      break;
+    case UNKNOWN:
+      return false;
+  }
+  this->tokens.push_back("-" + std::to_string(level));
+  return true;
+}
+
+bool Compressor::set_fastest_level() {
+  return this->set_level(this->family == XZ ? 0 : 1);
+}
+
+bool Compressor::set_threads(int threads) {
+  switch (this->family) {
+    case ZSTD:
+      this->remove_tokens([](const std::string &t) {
+        return (starts_with(t, "-T") && t.size() > 2) || starts_with(t, "--threads=");
+      });
+      this->tokens.push_back("-T" + std::to_string(threads));
+      return true;
+    case XZ:
+      this->remove_tokens([](const std::string &t) {
+        return (starts_with(t, "-T") && t.size() > 2) || starts_with(t, "--threads=");
+      });
+      this->remove_tokens([](const std::string &t) { return t == "-T" || t == "--threads"; }, true);
+      this->tokens.push_back("--threads=" + std::to_string(threads));
+      return true;
+    case PIGZ:
+      if (threads == 0)
+        return false;
+      this->remove_tokens([](const std::string &t) { return t == "-p" || t == "--processes"; }, true);
+      this->tokens.push_back("-p");
+      this->tokens.push_back(std::to_string(threads));
+      return true;
+    default:
+      return false;
+  }
+}
+
+int Compressor::get_threads() {
+  int threads = -1;
+  for (size_t i = 0; i < this->tokens.size(); i++) {
+    const std::string &t = this->tokens[i];
+    std::string value;
+    if (this->family == ZSTD || this->family == XZ) {
+      if (starts_with(t, "-T") && t.size() > 2)
+        value = t.substr(2);
+      else if (starts_with(t, "--threads="))
+        value = t.substr(10);
+      else if ((t == "-T" || t == "--threads") && this->family == XZ && i + 1 < this->tokens.size())
+        value = this->tokens[i + 1];
+    } else if (this->family == PIGZ && (t == "-p" || t == "--processes") && i + 1 < this->tokens.size()) {
+      value = this->tokens[i + 1];
+    }
+    if (value.empty())
+      continue;
+    try {
+      threads = std::stoi(value);
+    } catch (...) {
+    }
+  }
+  return threads;
+}
+
+bool Compressor::set_dictionary(const std::string &dictionary) {
+  if (this->family != ZSTD)
+    return false;
+  this->remove_tokens([](const std::string &t) { return t == "-D"; }, true);
+  if (dictionary.empty())
+    return true;
+  this->tokens.push_back("-D");
+  this->tokens.push_back(dictionary);
+  return true;
+}
+
+std::string Compressor::get_command() {
+  std::string command;
+  for (const std::string &token : this->tokens) {
+    if (!command.empty())
+      command += ' ';
+    if (token.find_first_of(" \t'\"\\") == std::string::npos) {
+      command += token;
+      continue;
+    }
+    command += '\'';
+    for (char c : token) {
+      if (c == '\'')
+        command += "'\\''";
+      else
+        command += c;
+    }
+    command += '\'';
+  }
+  return command;
+}
+
+bool Compressor::setup(Subprocess &process) {
+  if (this->tokens.empty() || !process.set_executable(this->tokens[0]))
+    return true;
+  for (size_t i = 1; i < this->tokens.size(); i++)
+    process.add_argument(this->tokens[i]);
+  return false;
+}
+
+bool Compressor::setup_decompress(Subprocess &process) {
+  if (this->tokens.empty() || !process.set_executable(this->tokens[0]))
+    return true;
+  /* the level and thread flags only matter when compressing */
+  process.add_argument("-d");
+  process.add_argument("-c");
+  /* zstd refuses windows over 128M without being told, --long makes them */
+  if (this->family == ZSTD)
+    process.add_argument("--long=31");
+  return false;
+}
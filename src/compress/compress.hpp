@@ -0,0 +1,80 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "subprocess/subprocess.hpp"
+
+#include <string>
+#include <vector>
+
+/* a compress_program command line, which knows the level and thread flags of the common compressors */
+/* so backman can adjust them (ie to meet a deadline) without the user spelling out every variant */
+class Compressor {
+  public:
+
+  enum Family {
+    UNKNOWN, /* can be run, but not adjusted */
+    ZSTD,
+    XZ,
+    GZIP,
+    PIGZ,
+    BZIP2,
+    LZ4,
+  };
+
+  Compressor(const std::string &command);
+
+  Family      get_family();
+
+  /* these return false (and leave the command alone) if the family doesn't support it */
+  bool        set_level(int level);
+  bool        set_fastest_level();
+  /* 0 means one thread per core */
+  bool        set_threads(int threads);
+  /* the thread count the command asks for, 0 for one per core, -1 if it doesn't say */
+  int         get_threads();
+  /* zstd only, every block (and every thread's job) starts out primed with the dictionary */
+  /* an empty `dictionary` drops it again */
+  bool        set_dictionary(const std::string &dictionary);
+
+  /* the command line, requoted */
+  std::string get_command();
+
+  /* sets the executable and arguments of `process` to compress stdin to stdout */
+  /* returns true if the executable wasn't found */
+  bool        setup(Subprocess &process);
+  /* the same to decompress, with -d as every family (and most others) take it */
+  bool        setup_decompress(Subprocess &process);
+
+  /* splits a command line on whitespace, honouring '', "" and \ */
+  static std::vector<std::string> split_command(const std::string &command);
+
+  private:
+  std::vector<std::string> tokens;
+  Family                   family = UNKNOWN;
+
+  /* removes every token for which `matches` returns true, along with `takes_value` following tokens */
+  template <typename Pred>
+  void remove_tokens(Pred matches, bool takes_value = false);
+};
@@ -0,0 +1,54 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "cpubudget/cpubudget.hpp"
+
+#include <algorithm>
+
+CpuBudget::CpuBudget(int threads, int slots, size_t targets) {
+  this->threads = std::max(threads, 1);
+  this->slots = std::max(slots, 1);
+  this->free = this->threads;
+  this->pending = targets;
+  this->active = 0;
+}
+
+int CpuBudget::acquire() {
+  std::lock_guard guard(this->lock);
+  if (this->pending > 0)
+    this->pending--;
+  this->active++;
+
+  size_t sharing = std::min<size_t>(this->slots, this->active + this->pending);
+  int share = this->threads / (int)std::max<size_t>(sharing, 1);
+  share = std::max(std::min(share, this->free), 1);
+  this->free -= share;
+  return share;
+}
+
+void CpuBudget::release(int threads) {
+  std::lock_guard guard(this->lock);
+  this->free += threads;
+  if (this->active > 0)
+    this->active--;
+}
@@ -0,0 +1,51 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+/* the compression and encryption threads of every target of a run, so targets */
+/* running at once don't each start a thread per core */
+/* a compressor's thread count is fixed when it starts, so the threads are */
+/* rebalanced as each target starts: a share is what finished targets gave back, */
+/* up to an even split between the targets that can still run at the same time */
+class CpuBudget {
+  public:
+  /* `threads` shared by `targets` targets, at most `slots` of which run at once */
+  CpuBudget(int threads, int slots, size_t targets);
+
+  /* a starting target's share, at least one thread even if none are free */
+  int  acquire();
+  /* gives a finished target's share back */
+  void release(int threads);
+
+  private:
+  std::mutex lock;
+  int        threads;
+  int        slots;
+  int        free;
+  size_t     pending; /* targets not started yet */
+  size_t     active;  /* targets holding a share */
+};
@@ -0,0 +1,659 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "delta/delta.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char delta_magic[] = "BACKMAN-DELTA1\n";
+static const char signature_magic[] = "BACKMAN-SIG1\n";
+/* ends a file's blocks in a delta stream */
+static constexpr uint64_t end_of_blocks = UINT64_MAX;
+/* the file wasn't in the base, so its blocks start from zeros rather than the old file */
+static constexpr uint32_t file_full = 1;
+
+namespace {
+
+/* buffers what's written to an fd, integers are little endian */
+class Output {
+  public:
+  bool failed = false;
+
+  explicit Output(int fd) : fd(fd) {}
+
+  void u32(uint32_t value) {
+    for (int i = 0; i < 4; i++)
+      this->buffer.push_back((char)(value >> (8 * i)));
+  }
+  void u64(uint64_t value) {
+    for (int i = 0; i < 8; i++)
+      this->buffer.push_back((char)(value >> (8 * i)));
+  }
+  void str(const std::string &value) {
+    this->u32(value.size());
+    this->bytes(value.data(), value.size());
+  }
+  void bytes(const char *data, size_t length) {
+    this->buffer.append(data, length);
+    if (this->buffer.size() >= 1 << 20)
+      this->flush();
+  }
+  bool flush() {
+    size_t written = 0;
+    while (!this->failed && written < this->buffer.size()) {
+      ssize_t n = ::write(this->fd, this->buffer.data() + written, this->buffer.size() - written);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+        this->failed = true;
+      else
+        written += n;
+    }
+    this->buffer.clear();
+    return !this->failed;
+  }
+
+  private:
+  int         fd;
+  std::string buffer;
+};
+
+/* the other side of Output, every read fails once the fd runs out */
+class Input {
+  public:
+  explicit Input(int fd) : fd(fd) {}
+
+  bool bytes(char *data, size_t length) {
+    while (length > 0) {
+      if (this->position == this->buffer.size() && !this->fill())
+        return false;
+      size_t n = std::min(length, this->buffer.size() - this->position);
+      std::memcpy(data, this->buffer.data() + this->position, n);
+      this->position += n;
+      data += n;
+      length -= n;
+    }
+    return true;
+  }
+  bool u32(uint32_t &value) {
+    unsigned char data[4];
+    if (!this->bytes((char *)data, 4))
+      return false;
+    value = 0;
+    for (int i = 0; i < 4; i++)
+      value |= (uint32_t)data[i] << (8 * i);
+    return true;
+  }
+  bool u64(uint64_t &value) {
+    unsigned char data[8];
+    if (!this->bytes((char *)data, 8))
+      return false;
+    value = 0;
+    for (int i = 0; i < 8; i++)
+      value |= (uint64_t)data[i] << (8 * i);
+    return true;
+  }
+  bool str(std::string &value) {
+    uint32_t length;
+    if (!this->u32(length) || length > 1 << 20)
+      return false;
+    value.resize(length);
+    return this->bytes(value.data(), length);
+  }
+
+  private:
+  int         fd;
+  std::string buffer;
+  size_t      position = 0;
+
+  bool fill() {
+    this->buffer.resize(1 << 20);
+    ssize_t n;
+    do {
+      n = read(this->fd, this->buffer.data(), this->buffer.size());
+    } while (n == -1 && errno == EINTR);
+    this->buffer.resize(n > 0 ? n : 0);
+    this->position = 0;
+    return n > 0;
+  }
+};
+
+} // namespace
+
+static bool is_zero(const char *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/* murmur3's 128 bit mix, seeded with the length so a block that only shrank differs */
+DeltaWriter::Hash DeltaWriter::hash_block(const char *data, size_t length) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  uint64_t h1 = length;
+  uint64_t h2 = length;
+  for (size_t i = 0; i < length; i += 16) {
+    uint64_t k[2] = {0, 0};
+    std::memcpy(k, data + i, std::min<size_t>(16, length - i));
+    uint64_t k1 = k[0];
+    uint64_t k2 = k[1];
+    k1 *= c1;
+    k1 = rotl64(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = rotl64(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2;
+    k2 = rotl64(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = rotl64(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  return {h1, h2};
+}
+
+DeltaWriter::DeltaWriter(const fs::path &signature_path, const std::string &archive_name)
+    : signature_path(signature_path), archive_name(archive_name) {
+  this->load();
+}
+
+void DeltaWriter::load() {
+  int fd = open(this->signature_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  Input in{fd};
+  char magic[sizeof(signature_magic) - 1];
+  uint32_t file_block_size = 0;
+  std::string base;
+  bool ok = in.bytes(magic, sizeof(magic)) &&
+            std::memcmp(magic, signature_magic, sizeof(magic)) == 0 &&
+            in.u32(file_block_size) && in.str(base);
+  while (ok) {
+    std::string path;
+    if (!(ok = in.str(path)) || path.empty())
+      break;
+    Signature signature;
+    uint64_t mtime_sec, ctime_sec, count;
+    ok = in.u64(signature.size) && in.u64(mtime_sec) && in.u32(signature.mtime_nsec) &&
+         in.u64(ctime_sec) && in.u32(signature.ctime_nsec) && in.u64(signature.ino) &&
+         in.u64(count) && count <= (signature.size + block_size - 1) / block_size;
+    signature.mtime_sec = mtime_sec;
+    signature.ctime_sec = ctime_sec;
+    for (uint64_t i = 0; ok && i < count; i++) {
+      Hash hash;
+      ok = in.u64(hash[0]) && in.u64(hash[1]);
+      signature.blocks.push_back(hash);
+    }
+    this->signatures[path] = std::move(signature);
+  }
+  close(fd);
+
+  if (!ok) {
+    Logger::logf(Logger::WARN, "\"%s\" is damaged, writing a full delta", this->signature_path.c_str());
+    this->signatures.clear();
+  } else if (file_block_size != block_size) {
+    this->signatures.clear();
+  } else if (base == this->archive_name) {
+    /* this run replaces the archive the signatures describe */
+    this->signatures.clear();
+  } else {
+    this->base = base;
+  }
+}
+
+void DeltaWriter::add(const Walker::Entry &entry) {
+  this->files.push_back({entry.path, entry.st});
+}
+
+size_t DeltaWriter::size() {
+  return this->files.size();
+}
+
+bool DeltaWriter::write(int fd) {
+  Output out{fd};
+  out.bytes(delta_magic, sizeof(delta_magic) - 1);
+  out.u32(block_size);
+  out.str(this->archive_name);
+  out.str(this->base);
+
+  bool ok = true;
+  uint64_t changed = 0;
+  std::vector<char> block(block_size);
+  for (const File &file : this->files) {
+    auto old = this->signatures.find(file.path);
+    const Signature *previous = old == this->signatures.end() ? NULL : &old->second;
+    Signature signature{(uint64_t)file.st.st_size,
+                        file.st.st_mtim.tv_sec, (uint32_t)file.st.st_mtim.tv_nsec,
+                        file.st.st_ctim.tv_sec, (uint32_t)file.st.st_ctim.tv_nsec,
+                        file.st.st_ino, {}};
+    /* a file that wasn't written to since keeps its blocks without being read */
+    bool unchanged = previous != NULL && previous->size == signature.size &&
+                     previous->mtime_sec == signature.mtime_sec &&
+                     previous->mtime_nsec == signature.mtime_nsec &&
+                     previous->ctime_sec == signature.ctime_sec &&
+                     previous->ctime_nsec == signature.ctime_nsec &&
+                     previous->ino == signature.ino;
+    int in = -1;
+    if (!unchanged) {
+      in = open(file.path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+      if (in == -1) {
+        Logger::logf(Logger::ERROR, "can't read \"%s\": %s", file.path.c_str(), strerror(errno));
+        ok = false;
+        continue;
+      }
+      posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    out.str(file.path);
+    out.u64(signature.size);
+    out.u32(previous == NULL ? file_full : 0);
+    out.u32(file.st.st_mode);
+    out.u32(file.st.st_uid);
+    out.u32(file.st.st_gid);
+    out.u64(signature.mtime_sec);
+    out.u32(signature.mtime_nsec);
+
+    if (unchanged) {
+      signature.blocks = previous->blocks;
+    } else {
+      bool short_read = false;
+      for (uint64_t i = 0; i * block_size < signature.size && !out.failed; i++) {
+        size_t length = std::min<uint64_t>(block_size, signature.size - i * block_size);
+        size_t got = 0;
+        while (got < length) {
+          ssize_t n = read(in, block.data() + got, length - got);
+          if (n == -1 && errno == EINTR)
+            continue;
+          if (n == -1) {
+            Logger::logf(Logger::ERROR, "can't read \"%s\": %s", file.path.c_str(), strerror(errno));
+            ok = false;
+          }
+          if (n <= 0)
+            break;
+          got += n;
+        }
+        if (got < length) {
+          /* like tar, a file that shrank while being read is padded */
+          if (!short_read)
+            Logger::logf(Logger::WARN, "\"%s\" shrank while being read, padding with zeros", file.path.c_str());
+          short_read = true;
+          std::memset(block.data() + got, 0, length - got);
+        }
+        Hash hash = hash_block(block.data(), length);
+        bool differs = previous != NULL
+                           ? i >= previous->blocks.size() || previous->blocks[i] != hash
+                           : !is_zero(block.data(), length);
+        signature.blocks.push_back(hash);
+        if (differs) {
+          out.u64(i);
+          out.bytes(block.data(), length);
+          changed += length;
+        }
+      }
+      close(in);
+    }
+    out.u64(end_of_blocks);
+    this->new_signatures[file.path] = std::move(signature);
+    if (out.failed)
+      break;
+  }
+  out.str("");
+  if (!out.flush()) {
+    Logger::logf(Logger::ERROR, "can't write the delta stream: %s", strerror(errno));
+    return false;
+  }
+  Logger::logf(Logger::INFO, "%zu big files archived as deltas, %llu bytes changed",
+               this->files.size(), (unsigned long long)changed);
+  return ok;
+}
+
+bool DeltaWriter::save() {
+  fs::path temporary = this->signature_path;
+  temporary += ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    Logger::logf(Logger::ERROR, "can't write \"%s\": %s", temporary.c_str(), strerror(errno));
+    return false;
+  }
+  Output out{fd};
+  out.bytes(signature_magic, sizeof(signature_magic) - 1);
+  out.u32(block_size);
+  out.str(this->archive_name);
+  for (auto &entry : this->new_signatures) {
+    const Signature &signature = entry.second;
+    out.str(entry.first);
+    out.u64(signature.size);
+    out.u64(signature.mtime_sec);
+    out.u32(signature.mtime_nsec);
+    out.u64(signature.ctime_sec);
+    out.u32(signature.ctime_nsec);
+    out.u64(signature.ino);
+    out.u64(signature.blocks.size());
+    for (const Hash &hash : signature.blocks) {
+      out.u64(hash[0]);
+      out.u64(hash[1]);
+    }
+  }
+  out.str("");
+  bool ok = out.flush() && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(temporary.c_str(), this->signature_path.c_str()) == -1) {
+    Logger::logf(Logger::ERROR, "can't write \"%s\": %s", this->signature_path.c_str(), strerror(errno));
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool apply_delta(int fd, const fs::path &root) {
+  Input in{fd};
+  char magic[sizeof(delta_magic) - 1];
+  uint32_t stream_block_size;
+  std::string name, base;
+  if (!in.bytes(magic, sizeof(magic)) || std::memcmp(magic, delta_magic, sizeof(magic)) != 0 ||
+      !in.u32(stream_block_size) || stream_block_size == 0 || stream_block_size > 64 << 20 ||
+      !in.str(name) || !in.str(base)) {
+    Logger::log(Logger::ERROR, "not a delta stream (decrypt and decompress it first)");
+    return false;
+  }
+
+  fs::path marker = root / ".backman-delta";
+  std::string applied;
+  std::ifstream marker_in{marker};
+  std::getline(marker_in, applied);
+  if (!base.empty() && applied != base) {
+    Logger::logf(Logger::ERROR, "\"%s\" applies on top of \"%s\", but %s", name.c_str(), base.c_str(),
+                 applied.empty() ? "no delta was applied yet"
+                                 : ("\"" + applied + "\" was applied last").c_str());
+    return false;
+  }
+
+  size_t files = 0;
+  std::vector<char> block(stream_block_size);
+  for (;;) {
+    std::string path;
+    if (!in.str(path))
+      goto truncated;
+    if (path.empty())
+      break;
+    uint64_t size, mtime_sec;
+    uint32_t flags, mode, uid, gid, mtime_nsec;
+    if (!in.u64(size) || !in.u32(flags) || !in.u32(mode) || !in.u32(uid) || !in.u32(gid) ||
+        !in.u64(mtime_sec) || !in.u32(mtime_nsec))
+      goto truncated;
+
+    fs::path destination = root / fs::path(path).relative_path();
+    std::error_code ec;
+    fs::create_directories(destination.parent_path(), ec);
+    int out = open(destination.c_str(),
+                   O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC | (flags & file_full ? O_TRUNC : 0), 0600);
+    if (out == -1 || ftruncate(out, size) == -1) {
+      Logger::logf(Logger::ERROR, "can't write \"%s\": %s", destination.c_str(), strerror(errno));
+      return false;
+    }
+    for (;;) {
+      uint64_t index;
+      if (!in.u64(index)) {
+        close(out);
+        goto truncated;
+      }
+      if (index == end_of_blocks)
+        break;
+      if (index >= (size + stream_block_size - 1) / stream_block_size) {
+        close(out);
+        goto truncated;
+      }
+      size_t length = std::min<uint64_t>(stream_block_size, size - index * stream_block_size);
+      if (!in.bytes(block.data(), length)) {
+        close(out);
+        goto truncated;
+      }
+      if (pwrite(out, block.data(), length, index * stream_block_size) != (ssize_t)length) {
+        Logger::logf(Logger::ERROR, "can't write \"%s\": %s", destination.c_str(), strerror(errno));
+        close(out);
+        return false;
+      }
+    }
+    /* chown first, it clears the setuid and setgid bits */
+    if (geteuid() == 0)
+      fchown(out, uid, gid);
+    fchmod(out, mode & 07777);
+    struct timespec times[2] = {{(time_t)mtime_sec, (long)mtime_nsec},
+                                {(time_t)mtime_sec, (long)mtime_nsec}};
+    futimens(out, times);
+    close(out);
+    files++;
+  }
+
+  {
+    std::ofstream marker_out{marker};
+    marker_out << name << '\n';
+  }
+  Logger::logf(Logger::INFO, "applied \"%s\" to %zu files", name.c_str(), files);
+  return true;
+
+truncated:
+  Logger::logf(Logger::ERROR, "\"%s\" is truncated or damaged", name.c_str());
+  return false;
+}
+
+DeltaMerger::DeltaMerger(const fs::path &spool_dir) {
+  this->spool = open(spool_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (this->spool == -1) {
+    /* not every filesystem has O_TMPFILE */
+    std::string path = (spool_dir / ".backman-spool.XXXXXX").string();
+    this->spool = mkostemp(path.data(), O_CLOEXEC);
+    if (this->spool != -1)
+      unlink(path.c_str());
+  }
+  if (this->spool == -1)
+    Logger::logf(Logger::ERROR, "can't make a spool file in \"%s\": %s", spool_dir.c_str(), strerror(errno));
+}
+
+DeltaMerger::~DeltaMerger() {
+  if (this->spool != -1)
+    close(this->spool);
+}
+
+std::string DeltaMerger::get_base() { return this->base; }
+
+size_t DeltaMerger::get_count() { return this->count; }
+
+bool DeltaMerger::add(int fd) {
+  if (this->spool == -1)
+    return false;
+  Input in{fd};
+  char magic[sizeof(delta_magic) - 1];
+  uint32_t stream_block_size;
+  std::string name, base;
+  if (!in.bytes(magic, sizeof(magic)) || std::memcmp(magic, delta_magic, sizeof(magic)) != 0 ||
+      !in.u32(stream_block_size) || stream_block_size == 0 || stream_block_size > 64 << 20 ||
+      !in.str(name) || !in.str(base)) {
+    Logger::log(Logger::ERROR, "not a delta stream");
+    return false;
+  }
+  if (this->count == 0) {
+    this->name = name;
+    this->stream_block_size = stream_block_size;
+  } else if (name != this->base || stream_block_size != this->stream_block_size) {
+    Logger::logf(Logger::ERROR, "\"%s\" isn't the base of the delta before it, \"%s\" is",
+                 name.c_str(), this->base.c_str());
+    return false;
+  }
+
+  uint64_t bs = this->stream_block_size;
+  std::vector<char> block(bs);
+  for (;;) {
+    std::string path;
+    if (!in.str(path))
+      goto truncated;
+    if (path.empty())
+      break;
+    uint64_t size, mtime_sec;
+    uint32_t flags, mode, uid, gid, mtime_nsec;
+    if (!in.u64(size) || !in.u32(flags) || !in.u32(mode) || !in.u32(uid) || !in.u32(gid) ||
+        !in.u64(mtime_sec) || !in.u32(mtime_nsec))
+      goto truncated;
+
+    /* the newest delta decides which files there are and what they look like */
+    File *file = NULL;
+    if (this->count == 0) {
+      this->file_index[path] = this->files.size();
+      this->files.push_back({path, size, mode, uid, gid, mtime_sec, mtime_nsec,
+                             (size + bs - 1) / bs, false, {}});
+      file = &this->files.back();
+    } else {
+      auto found = this->file_index.find(path);
+      if (found != this->file_index.end() && !this->files[found->second].complete)
+        file = &this->files[found->second];
+    }
+
+    for (;;) {
+      uint64_t index;
+      if (!in.u64(index))
+        goto truncated;
+      if (index == end_of_blocks)
+        break;
+      if (index >= (size + bs - 1) / bs)
+        goto truncated;
+      size_t length = std::min<uint64_t>(bs, size - index * bs);
+      if (!in.bytes(block.data(), length))
+        goto truncated;
+      /* a newer delta rewrote it, or truncated the file below it */
+      if (file == NULL || index >= file->kept_blocks || file->blocks.count(index))
+        continue;
+      if (pwrite(this->spool, block.data(), length, this->spooled) != (ssize_t)length) {
+        Logger::logf(Logger::ERROR, "can't write the spool: %s", strerror(errno));
+        return false;
+      }
+      file->blocks[index] = {this->spooled, (uint32_t)length};
+      this->spooled += length;
+    }
+    if (file != NULL) {
+      file->kept_blocks = std::min(file->kept_blocks, (size + bs - 1) / bs);
+      file->complete = flags & file_full;
+    }
+  }
+
+  this->base = base;
+  this->count++;
+  return true;
+
+truncated:
+  Logger::logf(Logger::ERROR, "\"%s\" is truncated or damaged", name.c_str());
+  return false;
+}
+
+bool DeltaMerger::write(int fd) {
+  for (const File &file : this->files) {
+    if (!file.complete) {
+      Logger::logf(Logger::ERROR, "\"%s\" isn't stored whole anywhere in the chain", file.path.c_str());
+      return false;
+    }
+  }
+
+  Output out{fd};
+  out.bytes(delta_magic, sizeof(delta_magic) - 1);
+  out.u32(this->stream_block_size);
+  out.str(this->name);
+  out.str("");
+
+  uint64_t bs = this->stream_block_size;
+  std::vector<char> block(bs);
+  std::vector<uint64_t> indices;
+  for (const File &file : this->files) {
+    out.str(file.path);
+    out.u64(file.size);
+    out.u32(file_full);
+    out.u32(file.mode);
+    out.u32(file.uid);
+    out.u32(file.gid);
+    out.u64(file.mtime_sec);
+    out.u32(file.mtime_nsec);
+
+    indices.clear();
+    for (auto &entry : file.blocks)
+      indices.push_back(entry.first);
+    std::sort(indices.begin(), indices.end());
+    for (uint64_t index : indices) {
+      const Block &stored = file.blocks.at(index);
+      size_t length = std::min<uint64_t>(bs, file.size - index * bs);
+      size_t got = std::min<size_t>(length, stored.length);
+      if (pread(this->spool, block.data(), got, stored.offset) != (ssize_t)got) {
+        Logger::logf(Logger::ERROR, "can't read the spool: %s", strerror(errno));
+        return false;
+      }
+      std::memset(block.data() + got, 0, length - got);
+      /* a full delta leaves zeros to the truncate */
+      if (is_zero(block.data(), length))
+        continue;
+      out.u64(index);
+      out.bytes(block.data(), length);
+    }
+    out.u64(end_of_blocks);
+    if (out.failed)
+      break;
+  }
+  out.str("");
+  if (!out.flush()) {
+    Logger::logf(Logger::ERROR, "can't write the delta stream: %s", strerror(errno));
+    return false;
+  }
+  Logger::logf(Logger::INFO, "merged %zu deltas of %zu big files, %llu bytes",
+               this->count, this->files.size(), (unsigned long long)this->spooled);
+  return true;
+}
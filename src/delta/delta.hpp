@@ -0,0 +1,135 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "walker/walker.hpp"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* archives a target's big files as the blocks that changed since the last run, */
+/* comparing them to the block signatures that run left in destdir */
+/* a delta stream is a header naming itself and the delta it applies on top of */
+/* (none for a full one), then per file its metadata and changed blocks */
+class DeltaWriter {
+  public:
+  static constexpr uint32_t block_size = 256 * 1024;
+
+  /* `archive_name` is the name of the delta archive being written */
+  DeltaWriter(const std::filesystem::path &signature_path, const std::string &archive_name);
+
+  void   add(const Walker::Entry &entry);
+  size_t size();
+  /* writes the delta stream to `fd`, false if a file couldn't be read */
+  bool   write(int fd);
+  /* replaces the signatures with the ones write() made */
+  bool   save();
+
+  private:
+  using Hash = std::array<uint64_t, 2>;
+  struct Signature {
+    uint64_t          size;
+    int64_t           mtime_sec;
+    uint32_t          mtime_nsec;
+    int64_t           ctime_sec;
+    uint32_t          ctime_nsec;
+    uint64_t          ino;
+    std::vector<Hash> blocks;
+  };
+  struct File {
+    std::string path;
+    struct stat st;
+  };
+
+  std::filesystem::path                      signature_path;
+  std::string                                archive_name;
+  /* the delta the loaded signatures describe, empty to write a full one */
+  std::string                                base;
+  std::unordered_map<std::string, Signature> signatures;
+  std::unordered_map<std::string, Signature> new_signatures;
+  std::vector<File>                          files;
+
+  void load();
+  static Hash hash_block(const char *data, size_t length);
+};
+
+/* merges a chain of delta streams into one full delta, so restoring the newest */
+/* needs it alone, without reading the files they were made from again */
+/* the deltas are read newest first, each one's blocks that a newer delta didn't */
+/* replace are spooled to a temporary file and copied out as they are */
+class DeltaMerger {
+  public:
+  /* the spool is made in `spool_dir`, ideally on the disk the deltas are on */
+  explicit DeltaMerger(const std::filesystem::path &spool_dir);
+  ~DeltaMerger();
+
+  DeltaMerger(const DeltaMerger &) = delete;
+  DeltaMerger &operator=(const DeltaMerger &) = delete;
+
+  /* reads the next delta stream of the chain, the newest first and then each */
+  /* one's base, false if it's damaged or isn't the base of the one before */
+  bool        add(int fd);
+  /* the delta the last one added applies on top of, empty once a full one was added */
+  std::string get_base();
+  size_t      get_count();
+  /* writes the chain as a full delta stream named like its newest delta */
+  bool        write(int fd);
+
+  private:
+  struct Block {
+    uint64_t offset; /* in the spool */
+    uint32_t length;
+  };
+  struct File {
+    std::string path;
+    uint64_t    size;
+    uint32_t    mode, uid, gid;
+    uint64_t    mtime_sec;
+    uint32_t    mtime_nsec;
+    /* the blocks below this weren't cut off by a newer delta truncating the file */
+    uint64_t    kept_blocks;
+    /* a delta stored the file whole, older ones don't matter to it */
+    bool        complete = false;
+    std::unordered_map<uint64_t, Block> blocks;
+  };
+
+  int                                     spool = -1;
+  uint64_t                                spooled = 0;
+  uint32_t                                stream_block_size = 0;
+  std::string                             name;
+  std::string                             base;
+  size_t                                  count = 0;
+  /* in the newest delta's order */
+  std::vector<File>                       files;
+  std::unordered_map<std::string, size_t> file_index;
+};
+
+/* applies a delta stream read from `fd` to the files under `root`, false on error */
+/* deltas must be applied in order from a full one, the last one applied is kept */
+/* in root/.backman-delta so one applied out of order is refused */
+bool apply_delta(int fd, const std::filesystem::path &root);
@@ -0,0 +1,205 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "dictionary/dictionary.hpp"
+#include "log/log.h"
+#include "parser/parser.hpp"
+#include "subprocess/subprocess.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/* files up to this size are what the dictionary is for */
+static constexpr off_t small_file_size = 128 << 10;
+/* at most this many files are trained on */
+static constexpr size_t sample_files = 4000;
+/* zstd's default dictionary size */
+static constexpr size_t dictionary_size = 112640;
+/* fewer small files than this aren't worth a dictionary */
+static constexpr size_t minimum_files = 64;
+/* a dictionary is retrained after this many seconds regardless */
+static constexpr time_t maximum_age = 30 * 24 * 60 * 60;
+/* retrain when the extension mix moved more than this (total variation distance) */
+static constexpr double maximum_drift = 0.25;
+
+static std::string extension_of(const std::string &path) {
+  std::string ext = fs::path(path).extension().string();
+  return ext.empty() ? "." : ext;
+}
+
+double Dictionary::drift(const Profile &a, const Profile &b) {
+  std::map<std::string, double> diff = a.extensions;
+  for (auto &ext : b.extensions)
+    diff[ext.first] -= ext.second;
+  double distance = 0;
+  for (auto &ext : diff)
+    distance += ext.second < 0 ? -ext.second : ext.second;
+  return distance / 2;
+}
+
+void Dictionary::write_state(const fs::path &state_path, const fs::path &dictionary, time_t trained, const Profile &profile) {
+  FILE *file = fopen(state_path.c_str(), "w");
+  if (file == NULL) {
+    Logger::logf(Logger::WARN, "can't write \"%s\"", state_path.c_str());
+    return;
+  }
+  fprintf(file,
+          "# written by backman, describes the dictionary the next archive is compressed with\n"
+          "[dictionary]\n"
+          "file = \"%s\"\n"
+          "trained = %lld\n"
+          "files = %zu\n",
+          dictionary.filename().c_str(), (long long)trained, profile.files);
+  for (auto &ext : profile.extensions) {
+    /* only the extensions that make a difference to the drift */
+    if (ext.second >= 0.001)
+      fprintf(file, "extension = \"%s:%.4f\"\n", ext.first.c_str(), ext.second);
+  }
+  fclose(file);
+}
+
+Dictionary::Dictionary(const std::string &name, const fs::path &destdir) : name(name), destdir(destdir) {
+  /* xorshift, good enough to pick a sample */
+  this->rng = time(NULL) | 1;
+}
+
+void Dictionary::add(const Walker::Entry &entry) {
+  if (!S_ISREG(entry.st.st_mode) || entry.st.st_size == 0 || entry.st.st_size > small_file_size)
+    return;
+  if (faccessat(entry.dirfd, entry.name, R_OK, 0) != 0)
+    return;
+  this->files++;
+  this->extension_counts[extension_of(entry.path)]++;
+  /* reservoir sampling */
+  if (this->sample.size() < sample_files) {
+    this->sample.push_back(entry.path);
+    return;
+  }
+  this->rng ^= this->rng << 13;
+  this->rng ^= this->rng >> 7;
+  this->rng ^= this->rng << 17;
+  size_t slot = this->rng % this->files;
+  if (slot < sample_files)
+    this->sample[slot] = entry.path;
+}
+
+fs::path Dictionary::prepare() {
+  const std::string &name = this->name;
+  const fs::path &destdir = this->destdir;
+  std::vector<std::string> &sample = this->sample;
+  fs::path state_path = destdir / (name + ".dict.ini");
+
+  Profile profile;
+  profile.files = this->files;
+  for (auto &count : this->extension_counts)
+    profile.extensions[count.first] = (double)count.second / profile.files;
+
+  /* the current dictionary, if it still fits */
+  if (fs::exists(state_path)) {
+    try {
+      INI_Parser::INI_Data state = INI_Parser::ini_parse(state_path);
+      if (state.size() > 1 && state[1]["file"].size() == 1 && state[1]["trained"].size() == 1 && state[1]["files"].size() == 1) {
+        Profile trained_on;
+        trained_on.files = std::stoull(state[1]["files"][0]);
+        for (const std::string &value : state[1]["extension"]) {
+          size_t colon = value.rfind(':');
+          if (colon != std::string::npos)
+            trained_on.extensions[value.substr(0, colon)] = std::stod(value.substr(colon + 1));
+        }
+        fs::path current = destdir / state[1]["file"][0];
+        time_t age = time(NULL) - std::stoll(state[1]["trained"][0]);
+        double distance = drift(profile, trained_on);
+        bool count_changed = profile.files * 2 < trained_on.files || profile.files > trained_on.files * 2;
+        if (fs::exists(current) && age < maximum_age && distance <= maximum_drift && !count_changed) {
+          Logger::logf(Logger::DEBUG, "reusing dictionary \"%s\" (drift %.2f)", current.c_str(), distance);
+          return current;
+        }
+        Logger::logf(Logger::INFO, "retraining dictionary (drift %.2f, %zu small files, was %zu)", distance, profile.files, trained_on.files);
+      }
+    } catch (std::exception &e) {
+      Logger::logf(Logger::WARN, "ignoring malformed \"%s\"", state_path.c_str());
+    }
+  }
+
+  if (sample.size() < minimum_files) {
+    Logger::logf(Logger::INFO, "only %zu small files, not training a dictionary", sample.size());
+    return fs::path();
+  }
+
+  /* zstd reads the sample list from a file so the list can't hit ARG_MAX */
+  std::error_code ec;
+  fs::create_directories(destdir, ec);
+  std::string list_path = (destdir / ("." + name + ".dict-files-XXXXXX")).string();
+  int list_fd = mkostemp(list_path.data(), O_CLOEXEC);
+  if (list_fd == -1) {
+    Logger::logf(Logger::WARN, "can't create \"%s\"", list_path.c_str());
+    return fs::path();
+  }
+  fchmod(list_fd, 0600);
+  std::string list;
+  for (const std::string &path : sample)
+    list += path + '\n';
+  write(list_fd, list.data(), list.size());
+  close(list_fd);
+
+  time_t now = time(NULL);
+  struct tm tm = *localtime(&now);
+  char stamp[64];
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H%M%S", &tm);
+  fs::path dictionary = destdir / (name + "_" + stamp + ".dict");
+
+  Subprocess zstd;
+  if (!zstd.set_executable("zstd")) {
+    Logger::log(Logger::WARN, "zstd not found, can't train a dictionary");
+    fs::remove(list_path, ec);
+    return fs::path();
+  }
+  zstd.add_argument("--train");
+  zstd.add_argument("-q");
+  zstd.add_argument("--maxdict=" + std::to_string(dictionary_size));
+  zstd.add_argument("--filelist=" + list_path);
+  zstd.add_argument("-o");
+  zstd.add_argument(dictionary);
+
+  Logger::logf(Logger::INFO, "training dictionary on %zu of %zu small files", sample.size(), profile.files);
+  int code = zstd.run() ? -1 : zstd.join();
+  fs::remove(list_path, ec);
+  if (code != 0 || !fs::exists(dictionary)) {
+    Logger::logf(Logger::WARN, "training a dictionary failed (%d)", code);
+    return fs::path();
+  }
+  fs::permissions(dictionary, fs::perms::owner_read | fs::perms::owner_write, ec);
+
+  write_state(state_path, dictionary, now, profile);
+  return dictionary;
+}
@@ -0,0 +1,63 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "walker/walker.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+/* a zstd dictionary for the target `name`, trained on a sample of its small files */
+/* a new one (destdir/<name>_<time>.dict) is trained when there is none yet, it is too old, */
+/* or the small files drifted from what it was trained on */
+/* old dictionaries are kept, as the archives made with them need them to decompress */
+class Dictionary {
+  public:
+  Dictionary(const std::string &name, const std::filesystem::path &destdir);
+
+  /* feed it every entry of the target's walk */
+  void                  add(const Walker::Entry &entry);
+
+  /* returns the dictionary to compress with, or an empty path if no dictionary could be trained */
+  std::filesystem::path prepare();
+
+  private:
+  struct Profile {
+    size_t                        files = 0;
+    std::map<std::string, double> extensions; /* share of the small files with each extension */
+  };
+
+  std::string                   name;
+  std::filesystem::path         destdir;
+  std::map<std::string, size_t> extension_counts;
+  size_t                        files = 0;
+  std::vector<std::string>      sample;
+  uint64_t                      rng;
+
+  static double drift(const Profile &a, const Profile &b);
+  void          write_state(const std::filesystem::path &state_path, const std::filesystem::path &dictionary, time_t trained, const Profile &profile);
+};
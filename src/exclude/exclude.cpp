@@ -0,0 +1,240 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "exclude/exclude.hpp"
+#include "log/log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+ExcludeMatcher::ExcludeMatcher(const std::vector<std::string> &patterns) {
+  for (const std::string &pattern : patterns)
+    this->add(pattern);
+}
+
+static std::vector<std::string> split_components(const std::string &path) {
+  std::vector<std::string> components;
+  size_t start = 0;
+  for (;;) {
+    size_t end = path.find('/', start);
+    components.push_back(path.substr(start, end - start));
+    if (end == std::string::npos)
+      return components;
+    start = end + 1;
+  }
+}
+
+void ExcludeMatcher::add(const std::string &pattern) {
+  this->patterns.push_back(pattern);
+
+  if (pattern.find_first_of("*?[\\") == std::string::npos) {
+    std::vector<std::string> components = split_components(pattern);
+    size_t node = 0;
+    for (auto it = components.rbegin(); it != components.rend(); it++) {
+      auto child = this->literals[node].children.find(*it);
+      if (child == this->literals[node].children.end()) {
+        this->literals.emplace_back();
+        child = this->literals[node].children.emplace(*it, this->literals.size() - 1).first;
+      }
+      node = child->second;
+    }
+    this->literals[node].terminal = true;
+    return;
+  }
+
+  Glob glob{this->steps.size(), 0};
+  for (size_t i = 0; i < pattern.size(); i++) {
+    Step step;
+    char c = pattern[i];
+    if (c == '*') {
+      /* runs of stars are one star */
+      if (glob.length > 0 && this->steps.back().star)
+        continue;
+      step.star = true;
+    } else if (c == '?') {
+      step.chars.set();
+      step.chars.reset(0);
+    } else if (c == '\\' && i + 1 < pattern.size()) {
+      step.chars.set((unsigned char)pattern[++i]);
+    } else if (c == '[') {
+      /* find where fnmatch would end the bracket, a ] right after [ or [! is literal */
+      size_t end = i + 1;
+      if (end < pattern.size() && (pattern[end] == '!' || pattern[end] == '^'))
+        end++;
+      if (end < pattern.size() && pattern[end] == ']')
+        end++;
+      while (end < pattern.size() && pattern[end] != ']') {
+        if (pattern[end] == '[' && end + 1 < pattern.size() &&
+            (pattern[end + 1] == ':' || pattern[end + 1] == '.' || pattern[end + 1] == '=')) {
+          size_t close = pattern.find(std::string(1, pattern[end + 1]) + "]", end + 2);
+          end = close == std::string::npos ? pattern.size() : close + 2;
+        } else {
+          end++;
+        }
+      }
+      if (end >= pattern.size()) {
+        /* unterminated, fnmatch takes the [ literally */
+        step.chars.set('[');
+      } else {
+        /* let fnmatch decide the class a byte at a time, so ranges and [:classes:] */
+        /* mean exactly what they mean to tar */
+        std::string bracket = pattern.substr(i, end - i + 1);
+        char subject[2] = {0, 0};
+        for (int b = 1; b < 256; b++) {
+          subject[0] = (char)b;
+          if (fnmatch(bracket.c_str(), subject, 0) == 0)
+            step.chars.set(b);
+        }
+        i = end;
+      }
+    } else {
+      step.chars.set((unsigned char)c);
+    }
+    this->steps.push_back(step);
+    glob.length++;
+  }
+  this->globs.push_back(glob);
+}
+
+bool ExcludeMatcher::empty() const {
+  return this->patterns.empty();
+}
+
+bool ExcludeMatcher::matches(const std::string &path) const {
+  return this->match_literal(path) || this->match_glob(path);
+}
+
+bool ExcludeMatcher::match_literal(const std::string &path) const {
+  if (this->literals[0].children.empty())
+    return false;
+  size_t node = 0;
+  size_t end = path.size();
+  for (;;) {
+    size_t slash = end == 0 ? std::string::npos : path.rfind('/', end - 1);
+    size_t start = slash == std::string::npos ? 0 : slash + 1;
+    auto child = this->literals[node].children.find(path.substr(start, end - start));
+    if (child == this->literals[node].children.end())
+      return false;
+    node = child->second;
+    if (this->literals[node].terminal)
+      return true;
+    if (slash == std::string::npos)
+      return false;
+    end = slash;
+  }
+}
+
+bool ExcludeMatcher::match_glob(const std::string &path) const {
+  if (this->globs.empty())
+    return false;
+
+  /* a state is a glob and how many of its steps have matched, packed in one */
+  /* size_t, `seen` keeps each out of a state list twice */
+  std::vector<size_t> current, next;
+  std::vector<size_t> seen(this->steps.size() + this->globs.size() + 1, (size_t)-1);
+  size_t generation = 0;
+
+  /* adds state (glob g, step s) and whatever it reaches without consuming */
+  auto enter = [&](std::vector<size_t> &states, size_t g, size_t s) {
+    const Glob &glob = this->globs[g];
+    for (;;) {
+      /* the accepting state of g is numbered past the steps to keep it distinct */
+      size_t id = s == glob.length ? this->steps.size() + g : glob.first + s;
+      if (seen[id] == generation)
+        return;
+      seen[id] = generation;
+      states.push_back(g << 32 | s);
+      if (s == glob.length || !this->steps[glob.first + s].star)
+        return;
+      s++;
+    }
+  };
+  auto start_all = [&](std::vector<size_t> &states) {
+    for (size_t g = 0; g < this->globs.size(); g++)
+      enter(states, g, 0);
+  };
+  auto accepts = [&](const std::vector<size_t> &states) {
+    for (size_t state : states) {
+      if ((state & 0xffffffff) == this->globs[state >> 32].length)
+        return true;
+    }
+    return false;
+  };
+
+  start_all(current);
+  for (size_t i = 0; i < path.size(); i++) {
+    unsigned char c = path[i];
+    generation++;
+    next.clear();
+    for (size_t state : current) {
+      size_t g = state >> 32;
+      size_t s = state & 0xffffffff;
+      const Glob &glob = this->globs[g];
+      if (s == glob.length)
+        continue;
+      const Step &step = this->steps[glob.first + s];
+      if (step.star)
+        enter(next, g, s);
+      else if (step.chars.test(c))
+        enter(next, g, s + 1);
+    }
+    /* every component starts another try of every pattern */
+    if (c == '/')
+      start_all(next);
+    std::swap(current, next);
+    if (current.empty()) {
+      /* nothing can match until the next component starts */
+      size_t slash = path.find('/', i + 1);
+      if (slash == std::string::npos)
+        return false;
+      i = slash - 1;
+    }
+  }
+  return accepts(current);
+}
+
+int ExcludeMatcher::to_memfd() const {
+  int fd = memfd_create("backman-excludes", MFD_CLOEXEC);
+  if (fd == -1) {
+    Logger::logf(Logger::ERROR, "memfd_create() failed: %s", strerror(errno));
+    return -1;
+  }
+  std::string buffer;
+  for (const std::string &pattern : this->patterns)
+    buffer += pattern + '\n';
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+    if (n == -1) {
+      Logger::logf(Logger::ERROR, "can't write the exclude list: %s", strerror(errno));
+      close(fd);
+      return -1;
+    }
+    written += n;
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
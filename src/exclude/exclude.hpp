@@ -0,0 +1,72 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <bitset>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* the target's excludes compiled once, so the walker can test every path against */
+/* thousands of them without an fnmatch() per pattern per path */
+/* matches like tar's --exclude (--wildcards --no-anchored): a pattern matches if */
+/* it matches any trailing part of the path that starts at a component */
+class ExcludeMatcher {
+  public:
+  ExcludeMatcher() = default;
+  explicit ExcludeMatcher(const std::vector<std::string> &patterns);
+
+  void add(const std::string &pattern);
+  bool matches(const std::string &path) const;
+  bool empty() const;
+
+  /* the patterns one per line, for tar's --exclude-from, or -1 on error */
+  int to_memfd() const;
+
+  private:
+  /* patterns without wildcards, by their components last first, so walking a */
+  /* path's components backwards finds every suffix that equals one */
+  struct Node {
+    std::unordered_map<std::string, size_t> children;
+    bool terminal = false;
+  };
+  std::vector<Node> literals{1};
+
+  /* the rest, each a sequence of steps run together as one NFA */
+  struct Step {
+    std::bitset<256> chars; /* what the step consumes */
+    bool star = false;      /* consumes any run of chars instead */
+  };
+  struct Glob {
+    size_t first; /* of its steps in `steps`, followed by its accepting state */
+    size_t length;
+  };
+  std::vector<Step> steps;
+  std::vector<Glob> globs;
+
+  std::vector<std::string> patterns;
+
+  bool match_literal(const std::string &path) const;
+  bool match_glob(const std::string &path) const;
+};
@@ -0,0 +1,214 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "history/history.hpp"
+#include "log/log.h"
+#include "parser/parser.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+/* runs kept per target, older ones are dropped on save */
+static constexpr size_t records_per_target = 16;
+
+/* how much of a normal run a fast run is assumed to take before one has been recorded */
+static constexpr double fast_guess = 0.5;
+
+History::Store::Store(std::filesystem::path path) : path(path) {}
+
+std::vector<History::Record> History::Store::read(const std::filesystem::path &path) {
+  std::vector<Record> records;
+  if (!std::filesystem::exists(path))
+    return records;
+
+  INI_Parser::INI_Data data;
+  try {
+    data = INI_Parser::ini_parse(path);
+  } catch (std::exception &e) {
+    Logger::logf(Logger::WARN, "can't read history \"%s\": %s", path.c_str(), e.what());
+    return records;
+  }
+
+  for (INI_Parser::INI_Section &section : data) {
+    if (section.get_section_name() != "run")
+      continue;
+    if (section["target"].size() != 1)
+      continue;
+    Record record;
+    record.target = section["target"][0];
+    try {
+      if (section["start"].size() == 1)
+        record.start = std::stoll(section["start"][0]);
+      if (section["duration"].size() == 1)
+        record.duration = std::stod(section["duration"][0]);
+      if (section["bytes_in"].size() == 1)
+        record.bytes_in = std::stoull(section["bytes_in"][0]);
+      if (section["bytes_out"].size() == 1)
+        record.bytes_out = std::stoull(section["bytes_out"][0]);
+    } catch (...) {
+      Logger::logf(Logger::WARN, "ignoring malformed history entry for \"%s\"", record.target.c_str());
+      continue;
+    }
+    record.fast = section["fast"].size() == 1 && section["fast"][0] == "true";
+    /* "<seconds> <key>" */
+    for (const std::string &hook : section["hook"]) {
+      size_t space = hook.find(' ');
+      try {
+        if (space != std::string::npos)
+          record.hooks.emplace_back(hook.substr(space + 1), std::stod(hook.substr(0, space)));
+      } catch (...) {
+      }
+    }
+    records.push_back(record);
+  }
+  return records;
+}
+
+void History::Store::load() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  this->records = History::Store::read(this->path);
+}
+
+void History::Store::add(Record record) {
+  std::lock_guard<std::mutex> guard(this->lock);
+  this->records.push_back(record);
+  this->added.push_back(record);
+}
+
+bool History::Store::save() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  if (this->added.empty())
+    return true;
+
+  std::error_code ec;
+  std::filesystem::create_directories(this->path.parent_path(), ec);
+
+  std::filesystem::path lock_path = this->path;
+  lock_path += ".lock";
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+    Logger::logf(Logger::WARN, "can't lock history \"%s\"", lock_path.c_str());
+    if (lock_fd != -1)
+      close(lock_fd);
+    return false;
+  }
+
+  std::vector<Record> merged = History::Store::read(this->path);
+  merged.insert(merged.end(), this->added.begin(), this->added.end());
+  std::stable_sort(merged.begin(), merged.end(), [](const Record &a, const Record &b) {
+    return a.target != b.target ? a.target < b.target : a.start < b.start;
+  });
+
+  std::filesystem::path tmp_path = this->path;
+  tmp_path += ".tmp";
+  FILE *file = fopen(tmp_path.c_str(), "w");
+  bool ok = file != NULL;
+  if (ok) {
+    fprintf(file, "# written by backman, runs per target are used to order targets and predict deadlines\n");
+    for (size_t i = 0; i < merged.size(); i++) {
+      /* only the newest records_per_target of every target */
+      size_t newer = 0;
+      for (size_t j = i + 1; j < merged.size() && merged[j].target == merged[i].target; j++)
+        newer++;
+      if (newer >= records_per_target)
+        continue;
+      const Record &record = merged[i];
+      fprintf(file,
+              "\n[run]\n"
+              "target = \"%s\"\n"
+              "start = %lld\n"
+              "duration = %.3f\n"
+              "bytes_in = %llu\n"
+              "bytes_out = %llu\n"
+              "fast = %s\n",
+              record.target.c_str(), (long long)record.start, record.duration,
+              (unsigned long long)record.bytes_in, (unsigned long long)record.bytes_out,
+              record.fast ? "true" : "false");
+      for (const auto &hook : record.hooks)
+        fprintf(file, "hook = \"%.3f %s\"\n", hook.second, hook.first.c_str());
+    }
+    ok = !ferror(file);
+    ok &= fclose(file) == 0;
+  }
+  ok = ok && rename(tmp_path.c_str(), this->path.c_str()) == 0;
+  if (!ok)
+    Logger::logf(Logger::WARN, "can't write history \"%s\"", this->path.c_str());
+  else
+    this->added.clear();
+
+  flock(lock_fd, LOCK_UN);
+  close(lock_fd);
+  return ok;
+}
+
+std::vector<History::Record> History::Store::get_records(const std::string &target) {
+  std::lock_guard<std::mutex> guard(this->lock);
+  std::vector<Record> ret;
+  for (const Record &record : this->records) {
+    if (record.target == target)
+      ret.push_back(record);
+  }
+  std::sort(ret.begin(), ret.end(), [](const Record &a, const Record &b) { return a.start < b.start; });
+  return ret;
+}
+
+double History::Store::predict_duration(const std::string &target, bool fast) {
+  std::vector<Record> records = this->get_records(target);
+
+  std::vector<double> durations;
+  for (size_t i = records.size(); i > 0 && durations.size() < 5; i--) {
+    if (records[i - 1].fast == fast)
+      durations.push_back(records[i - 1].duration);
+  }
+  if (durations.empty()) {
+    if (!fast)
+      return -1;
+    double normal = this->predict_duration(target, false);
+    return normal < 0 ? -1 : normal * fast_guess;
+  }
+
+  std::sort(durations.begin(), durations.end());
+  return durations[durations.size() / 2];
+}
+
+double History::Store::predict_hook_duration(const std::string &target, const std::string &hook) {
+  std::vector<Record> records = this->get_records(target);
+
+  std::vector<double> durations;
+  for (size_t i = records.size(); i > 0 && durations.size() < 5; i--) {
+    for (const auto &recorded : records[i - 1].hooks) {
+      if (recorded.first == hook)
+        durations.push_back(recorded.second);
+    }
+  }
+  if (durations.empty())
+    return -1;
+
+  std::sort(durations.begin(), durations.end());
+  return durations[durations.size() / 2];
+}
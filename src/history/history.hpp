@@ -0,0 +1,81 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace History {
+
+  /* one run of one target */
+  struct Record {
+    std::string target;
+    time_t      start     = 0;
+    double      duration  = 0; /* seconds, from the first before hook to the last end hook */
+    uint64_t    bytes_in  = 0; /* uncompressed tar stream */
+    uint64_t    bytes_out = 0; /* size of the archive */
+    bool        fast      = false; /* compression was lowered to make a deadline */
+    /* the key and duration in seconds of each hook that ran */
+    std::vector<std::pair<std::string, double>> hooks;
+  };
+
+  /* a small ini file of the last few runs of every target */
+  class Store {
+    public:
+    Store(std::filesystem::path path);
+
+    /* a missing or unreadable file is an empty history */
+    void                load();
+
+    /* thread safe */
+    void                add(Record record);
+
+    /* merges the added records into whatever is on disk now (other invocations may have written to it) */
+    /* returns false if the history couldn't be written, which is never fatal */
+    bool                save();
+
+    std::vector<Record> get_records(const std::string &target);
+
+    /* median duration of the recent runs in seconds, -1 if the target has never run */
+    /* fast runs are guessed from normal ones until one has been recorded */
+    double              predict_duration(const std::string &target, bool fast);
+
+    /* median duration of the hook's recent runs in seconds, -1 if it has never run */
+    double              predict_hook_duration(const std::string &target, const std::string &hook);
+
+    private:
+    std::filesystem::path path;
+    std::vector<Record>   records;
+    std::vector<Record>   added;
+    std::mutex            lock;
+
+    static std::vector<Record> read(const std::filesystem::path &path);
+  };
+
+}
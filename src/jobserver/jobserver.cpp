@@ -0,0 +1,178 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "jobserver/jobserver.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+/* how often a blocked acquire() looks at the implicit slot, which isn't in the pipe */
+static constexpr int recheck_ms = 50;
+
+static std::mutex lock;
+static bool       implicit_free = true;
+static bool       client        = false;
+static int        read_fd       = -1;
+static int        write_fd      = -1;
+/* a description of our own, so O_NONBLOCK doesn't change the fd make and its other children share */
+static int reopen_fd(int fd, int flags) {
+  if (fcntl(fd, F_GETFD) == -1)
+    return -1;
+  return open(("/proc/self/fd/" + std::to_string(fd)).c_str(), flags | O_CLOEXEC);
+}
+
+/* the value of the last --jobserver-auth= (or the older --jobserver-fds=) in MAKEFLAGS */
+static std::string find_auth(const std::string &makeflags) {
+  std::string auth;
+  size_t start = 0;
+  while (start < makeflags.size()) {
+    size_t end = makeflags.find(' ', start);
+    if (end == std::string::npos)
+      end = makeflags.size();
+    std::string word = makeflags.substr(start, end - start);
+    for (const char *prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+      if (word.rfind(prefix, 0) == 0)
+        auth = word.substr(std::strlen(prefix));
+    }
+    start = end + 1;
+  }
+  return auth;
+}
+
+static bool join(const std::string &auth) {
+  client = true;
+  if (auth.rfind("fifo:", 0) == 0) {
+    read_fd = open(auth.substr(5).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    write_fd = read_fd;
+  } else {
+    int r = -1, w = -1;
+    if (std::sscanf(auth.c_str(), "%d,%d", &r, &w) == 2) {
+      read_fd = reopen_fd(r, O_RDONLY | O_NONBLOCK);
+      write_fd = reopen_fd(w, O_WRONLY);
+    }
+  }
+  if (read_fd == -1 || write_fd == -1) {
+    /* what make does too, likely a recipe without a leading + */
+    Logger::logf(Logger::WARN, "can't use the jobserver \"%s\" in MAKEFLAGS, running one job at a time", auth.c_str());
+    if (read_fd != -1)
+      close(read_fd);
+    if (write_fd != -1 && write_fd != read_fd)
+      close(write_fd);
+    read_fd = write_fd = -1;
+  }
+  return false;
+}
+
+static bool serve(int jobs) {
+  /* a pipe our children inherit, rather than a fifo, which make before 4.4 can't join */
+  int fds[2];
+  if (pipe(fds) != 0) {
+    Logger::logf(Logger::ERROR, "can't create the jobserver pipe: %s", strerror(errno));
+    return true;
+  }
+  read_fd = reopen_fd(fds[0], O_RDONLY | O_NONBLOCK);
+  write_fd = fds[1];
+  if (read_fd == -1) {
+    Logger::logf(Logger::ERROR, "can't reopen the jobserver pipe: %s", strerror(errno));
+    return true;
+  }
+
+  /* every slot is in the pipe, a hook running make holds one, which its make treats as its own */
+  implicit_free = false;
+  std::string tokens(std::max(jobs, 1), '+');
+  if (write(write_fd, tokens.data(), tokens.size()) != (ssize_t)tokens.size()) {
+    Logger::logf(Logger::ERROR, "can't fill the jobserver pipe: %s", strerror(errno));
+    return true;
+  }
+
+  const char *old = std::getenv("MAKEFLAGS");
+  std::string makeflags = old ? old : "";
+  makeflags += " -j" + std::to_string(jobs) + " --jobserver-auth=" + std::to_string(fds[0]) + "," + std::to_string(fds[1]);
+  setenv("MAKEFLAGS", makeflags.c_str(), 1);
+  Logger::logf(Logger::DEBUG, "serving %d jobs through fds %d,%d", jobs, fds[0], fds[1]);
+  return false;
+}
+
+bool Jobserver::setup(int jobs) {
+  const char *makeflags = std::getenv("MAKEFLAGS");
+  std::string auth = makeflags ? find_auth(makeflags) : "";
+  if (!auth.empty())
+    return join(auth);
+  return serve(jobs);
+}
+
+bool Jobserver::is_client() { return client; }
+
+int Jobserver::get_fd() { return read_fd; }
+
+bool Jobserver::try_acquire(Slot &slot) {
+  {
+    std::lock_guard guard(lock);
+    if (implicit_free) {
+      implicit_free = false;
+      slot = Slot{true, '+'};
+      return true;
+    }
+  }
+  if (read_fd == -1)
+    return false;
+  char token;
+  ssize_t ret;
+  while ((ret = read(read_fd, &token, 1)) == -1 && errno == EINTR)
+    ;
+  if (ret != 1)
+    return false;
+  slot = Slot{false, token};
+  return true;
+}
+
+Jobserver::Slot Jobserver::acquire() {
+  Slot slot;
+  while (!try_acquire(slot)) {
+    struct pollfd fd = {read_fd, POLLIN, 0};
+    poll(&fd, read_fd == -1 ? 0 : 1, recheck_ms);
+  }
+  return slot;
+}
+
+void Jobserver::release(const Slot &slot) {
+  if (slot.implicit) {
+    std::lock_guard guard(lock);
+    implicit_free = true;
+    return;
+  }
+  ssize_t ret;
+  while ((ret = write(write_fd, &slot.token, 1)) == -1 && errno == EINTR)
+    ;
+  if (ret != 1)
+    Logger::logf(Logger::ERROR, "can't give a slot back to the jobserver: %s", strerror(errno));
+}
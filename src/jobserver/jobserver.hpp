@@ -0,0 +1,53 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+/* the GNU make jobserver protocol: a pipe (or fifo) holding a byte per free slot, */
+/* read one to start a job and write it back when the job is done, plus a slot */
+/* every process has without reading one */
+/* every hook holds a slot while it runs, and so does every target's archive run */
+/* when the slots come from a caller. children find the pool through MAKEFLAGS */
+namespace Jobserver {
+
+  struct Slot {
+    bool implicit = false; /* the process' own slot, not read from the pool */
+    char token = '+';      /* the byte read, given back as is */
+  };
+
+  /* joins the jobserver in MAKEFLAGS, or else serves `jobs` slots through a pipe */
+  /* and puts it in MAKEFLAGS for our children. returns true on error */
+  bool setup(int jobs);
+  /* whether the slots come from the process that started us */
+  bool is_client();
+
+  /* blocks until a slot is free */
+  Slot acquire();
+  /* returns false without blocking if no slot is free */
+  bool try_acquire(Slot &slot);
+  void release(const Slot &slot);
+
+  /* readable when a slot may be free, for polling alongside other fds (-1 if there is none) */
+  int  get_fd();
+
+}
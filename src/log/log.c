@@ -24,28 +24,332 @@
 
 #include "log.h"
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS   128 /* per thread, must be a power of two */
+#define LOG_MESSAGE_SIZE 512
+#define LOG_CONTEXT_SIZE 64
+
+typedef struct {
+  struct timespec time; /* CLOCK_MONOTONIC */
+  LOGLEVEL        level;
+  int             linenumber;
+  char const *    file;     /* __FILE__ and __func__ have static storage */
+  char const *    function;
+  int             truncated; /* the message didn't fit, it ends in "..." */
+  char            context[LOG_CONTEXT_SIZE];
+  char            message[LOG_MESSAGE_SIZE];
+} log_record;
+
+/* single producer (the owning thread) single consumer (the drain thread) */
+typedef struct log_ring {
+  _Atomic size_t   head;   /* next slot the owner writes */
+  _Atomic size_t   tail;   /* next slot the drain thread reads */
+  atomic_int       in_use; /* cleared when the owner exits so a new thread can adopt the ring */
+  size_t           drained_to; /* only touched by the drain thread */
+  struct log_ring *next;
+  log_record       records[LOG_RING_SLOTS];
+} log_ring;
 
 static LOGLEVEL _loglevel = INFO;
+static LOGFORMAT _logformat = LOGFORMAT_TEXT;
+
+/* rings are never freed, only adopted, so the list only ever grows at the head */
+static _Atomic(log_ring *) rings = NULL;
+static _Thread_local log_ring *thread_ring = NULL;
+static _Thread_local char thread_context[LOG_CONTEXT_SIZE] = "";
+
+static atomic_int async_running = 0;
+static atomic_int async_writers = 0; /* threads in _log that saw async_running set */
+static atomic_int drain_stop = 0;
+static pid_t async_pid = 0;
+static pthread_t drain_thread;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_once_t handlers_once = PTHREAD_ONCE_INIT;
 
 void set_loglevel(LOGLEVEL level) {
   _loglevel = level;
 }
 
+void set_logformat(LOGFORMAT format) {
+  _logformat = format;
+}
+
+void set_log_context(char const * context) {
+  if (context == NULL) {
+    thread_context[0] = '\0';
+    return;
+  }
+  snprintf(thread_context, sizeof(thread_context), "%s", context);
+}
+
+char const *get_log_context(void) {
+  return thread_context;
+}
+
+static char const *level_name(LOGLEVEL level) {
+  switch (level) {
+    case DEBUG: return "debug";
+    case INFO:  return "info";
+    case WARN:  return "warn";
+    case ERROR: return "error";
+  }
+  return "unknown";
+}
+
+static void write_json_string(FILE *out, char const *str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", out);
+    else if (c == '\t')
+      fputs("\\t", out);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+static void write_record(FILE *out, log_record const *record) {
+  if (_logformat == LOGFORMAT_JSON) {
+    fprintf(out, "{\"time\":%lld.%09ld,\"level\":\"%s\",\"target\":",
+            (long long) record->time.tv_sec, record->time.tv_nsec, level_name(record->level));
+    if (record->context[0])
+      write_json_string(out, record->context);
+    else
+      fputs("null", out);
+    fputs(",\"file\":", out);
+    write_json_string(out, record->file);
+    fputs(",\"function\":", out);
+    write_json_string(out, record->function);
+    fprintf(out, ",\"line\":%d,\"message\":", record->linenumber);
+    write_json_string(out, record->message);
+    if (record->truncated)
+      fputs(",\"truncated\":true", out);
+    fputs("}\n", out);
+    return;
+  }
+
+  fprintf(out, "[%5lld.%06ld] %-5s ", (long long) record->time.tv_sec, record->time.tv_nsec / 1000, level_name(record->level));
+  if (record->context[0])
+    fprintf(out, "(%s) ", record->context);
+  fprintf(out, "%s:%s:%d %s\n", record->file, record->function, record->linenumber, record->message);
+}
+
+static void release_ring(void *ring) {
+  atomic_store(&((log_ring *) ring)->in_use, 0);
+}
+
+static void make_ring_key(void) {
+  pthread_key_create(&ring_key, release_ring);
+}
+
+static log_ring *get_ring(void) {
+  if (thread_ring)
+    return thread_ring;
+
+  pthread_once(&ring_key_once, make_ring_key);
+
+  for (log_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1)) {
+      thread_ring = ring;
+      break;
+    }
+  }
+
+  if (!thread_ring) {
+    log_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+      return NULL;
+    atomic_init(&ring->in_use, 1);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+    thread_ring = ring;
+  }
+
+  pthread_setspecific(ring_key, thread_ring);
+  return thread_ring;
+}
+
+/* reserves the next slot of the calling thread's ring, NULL if the message has to be written synchronously */
+static log_record *reserve_record(log_ring **ring_out) {
+  log_ring *ring = get_ring();
+  if (!ring)
+    return NULL;
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SLOTS) {
+    /* full, wait for the drain thread rather than drop or reorder the message */
+    if (!atomic_load(&async_running))
+      return NULL;
+    sched_yield();
+  }
+
+  *ring_out = ring;
+  return &ring->records[head & (LOG_RING_SLOTS - 1)];
+}
+
+static int compare_records(void const *a, void const *b) {
+  struct timespec const *ta = &(*(log_record * const *) a)->time;
+  struct timespec const *tb = &(*(log_record * const *) b)->time;
+  if (ta->tv_sec != tb->tv_sec)
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  if (ta->tv_nsec != tb->tv_nsec)
+    return ta->tv_nsec < tb->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/* writes out everything currently pending in all rings, returns the number of messages written */
+static size_t drain_once(void) {
+  static log_record const **batch = NULL;
+  static size_t batch_capacity = 0;
+
+  size_t count = 0;
+  for (log_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; tail++) {
+      if (count == batch_capacity) {
+        size_t new_capacity = batch_capacity ? batch_capacity * 2 : LOG_RING_SLOTS;
+        log_record const **new_batch = realloc(batch, new_capacity * sizeof(*batch));
+        if (!new_batch)
+          break;
+        batch = new_batch;
+        batch_capacity = new_capacity;
+      }
+      batch[count++] = &ring->records[tail & (LOG_RING_SLOTS - 1)];
+    }
+    ring->drained_to = tail;
+  }
+  if (count == 0)
+    return 0;
+
+  qsort(batch, count, sizeof(*batch), compare_records);
+  for (size_t i = 0; i < count; i++)
+    write_record(stderr, batch[i]);
+  fflush(stderr);
+
+  /* the slots are only handed back once they have been written */
+  for (log_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+    if (ring->drained_to != atomic_load_explicit(&ring->tail, memory_order_relaxed))
+      atomic_store_explicit(&ring->tail, ring->drained_to, memory_order_release);
+  }
+  return count;
+}
+
+static void *drain(void *arg) {
+  (void) arg;
+  struct timespec idle = {0, 5 * 1000 * 1000};
+  for (;;) {
+    int stopping = atomic_load(&drain_stop);
+    if (drain_once() == 0) {
+      if (stopping)
+        break;
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+/* the drain thread doesn't exist in a forked child */
+static void child_after_fork(void) {
+  atomic_store(&async_running, 0);
+  atomic_store(&async_writers, 0);
+  atomic_store(&drain_stop, 0);
+}
+
+static void register_handlers(void) {
+  pthread_atfork(NULL, NULL, child_after_fork);
+  atexit(log_stop_async);
+}
+
+void log_start_async(void) {
+  if (atomic_load(&async_running))
+    return;
+  pthread_once(&handlers_once, register_handlers);
+
+  atomic_store(&drain_stop, 0);
+  if (pthread_create(&drain_thread, NULL, drain, NULL) != 0)
+    return; /* keep logging synchronously */
+  async_pid = getpid();
+  atomic_store(&async_running, 1);
+}
+
+void log_stop_async(void) {
+  if (!atomic_load(&async_running) || getpid() != async_pid)
+    return;
+  atomic_store(&drain_stop, 1);
+  pthread_join(drain_thread, NULL);
+  /* only now, a thread waiting for room in a full ring needs the drain thread until it's gone */
+  atomic_store(&async_running, 0);
+  /* a record reserved before that is published by the time its writer leaves _log */
+  while (atomic_load(&async_writers) > 0)
+    sched_yield();
+  while (drain_once() > 0);
+}
+
 void _log(char const * file, int linenumber, char const * const function, LOGLEVEL level, char const * const format, ...) {
   if (level < _loglevel) return;
 
+  char const * tmp = strstr(file, "/src/");
+  if (tmp) file = tmp + 1;
+
+  log_record sync_record;
+  log_ring *ring = NULL;
+  log_record *record = NULL;
+  if (atomic_load(&async_running)) {
+    /* checked again once counted, so log_stop_async either waits for the record or it goes out directly */
+    atomic_fetch_add(&async_writers, 1);
+    if (atomic_load(&async_running))
+      record = reserve_record(&ring);
+    if (record == NULL)
+      atomic_fetch_sub(&async_writers, 1);
+  }
+  if (record == NULL)
+    record = &sync_record;
+
+  clock_gettime(CLOCK_MONOTONIC, &record->time);
+  record->level = level;
+  record->linenumber = linenumber;
+  record->file = file;
+  record->function = function;
+  memcpy(record->context, thread_context, sizeof(record->context));
+
   va_list args;
   va_start(args, format);
+  int length = vsnprintf(record->message, sizeof(record->message), format, args);
+  va_end(args);
 
-  char const * tmp = strstr(file, "/src/");
-  if (tmp) file = tmp + 1;
+  record->truncated = length >= (int) sizeof(record->message);
+  if (record->truncated) {
+    /* end in "..." without cutting a multibyte character in half */
+    size_t end = sizeof(record->message) - 4;
+    while (end > 0 && ((unsigned char) record->message[end] & 0xc0) == 0x80)
+      end--;
+    memcpy(record->message + end, "...", 4);
+  }
+
+  if (ring) {
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1, memory_order_release);
+    atomic_fetch_sub(&async_writers, 1);
+    return;
+  }
 
-  fprintf(stderr, "%s:%s:%d ", file, function, linenumber);
-  vfprintf(stderr, format, args);
-  fprintf(stderr, "\n");
+  write_record(stderr, record);
   fflush(stderr);
 }
 
@@ -54,7 +358,9 @@ char *safe_format(const char *format, ...) {
 	va_list args;
 	va_start(args, format);
 
-	return vsafe_format(format, args);
+	char *ret = vsafe_format(format, args);
+	va_end(args);
+	return ret;
 }
 
 char *vsafe_format(const char *format, va_list args) {
@@ -40,13 +40,35 @@ extern "C" {
 #define log(loglevel, format) _log(__FILE__, __LINE__, __PRETTY_FUNCTION__, loglevel, format)
 
 typedef enum {
+DEBUG,
 INFO,
 WARN,
 ERROR,
 } LOGLEVEL;
 
+typedef enum {
+LOGFORMAT_TEXT,
+LOGFORMAT_JSON, /* one json object per line */
+} LOGFORMAT;
+
 void set_loglevel(LOGLEVEL level);
 
+void set_logformat(LOGFORMAT format);
+
+/* name attached to every message logged by the calling thread (usually the target name), NULL to clear */
+void set_log_context(char const * context);
+
+/* the calling thread's context, "" if there is none, for handing it to helper threads */
+char const *get_log_context(void);
+
+/* moves writing out of the logging threads and into a background thread */
+/* each thread logs into its own lock-free ring buffer, the background thread drains them in timestamp order */
+/* pending messages are flushed at exit, forked children fall back to writing synchronously */
+void log_start_async(void);
+
+/* flushes everything and returns to writing synchronously */
+void log_stop_async(void);
+
 
 /* internal function for logging, not meant to be used by anything except through the macro */
 void _log(char const * const file, int linenumber, char const * const function, LOGLEVEL level, char const * const format, ...);
@@ -24,17 +24,31 @@
 #include "parser/parser.hpp"
 
 #include "target/target.hpp"
+#include "calibrate/calibrate.hpp"
+#include "catalog/catalog.hpp"
+#include "compress/compress.hpp"
+#include "delta/delta.hpp"
+#include "history/history.hpp"
+#include "jobserver/jobserver.hpp"
+#include "scheduler/scheduler.hpp"
 #include "log/log.h"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <stddef.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <format>
 #include <string>
 #include <vector>
+#include <thread>
 #include <iostream>
 
 
@@ -43,6 +57,11 @@ namespace fs = std::filesystem;
 Options options;
 INI_Parser::INI_Data parsed_config;
 
+/* from linux/ioprio.h, which glibc doesn't wrap */
+static constexpr int ioprio_who_process = 1;
+static constexpr int ioprio_class_idle = 3;
+static constexpr int ioprio_class_shift = 13;
+
 static constexpr const char * const version_string = VERSION " built from " GIT_HASH;
 
 static constexpr char const * const help_format =
@@ -52,12 +71,34 @@ static constexpr char const * const help_format =
 "Options:\n"
 "  -h,  --help            Display this help text\n"
 "       --version         Display this help text (includes version)\n"
-"  -v,  --verbose         Increase verbocity (unimplemented)\n"
+"  -v,  --verbose         Increase verbocity (log debug messages)\n"
+"       --log-format <format>\n"
+"                         Log as \"text\" (default) or \"json\" lines\n"
 "  -j,  --jobs    <jobs>  Number of jobs to use (for hooks)\n"
+"                         Shared with hooks running make (or backman) through MAKEFLAGS\n"
+"                         Under a make jobserver its slots are used instead, by hooks and targets\n"
+"       --target-jobs <jobs>\n"
+"                         Number of targets to run at once (default 1)\n"
+"                         With more than one, the longest targets (by past runs) start first\n"
+"       --deadline <time> Time the run should be finished by, as HH:MM or a duration (ie 90m, 2h)\n"
+"                         Compression is lowered on long targets if past runs predict missing it\n"
 "       --destdir <dir>   Destination directory to put the archives (overrides dest option for targets)\n"
 "  -c,  --config  <file>  Config file, default $XDG_CONFIG_HOME/backman/backman.ini\n"
 "       --keep-going      Keep going after an errored target (unimplemented)\n"
 "       --print-targets   Print all available targets\n"
+"       --calibrate       Measure the destination, gpg and compressor speeds for the targets\n"
+"                         Targets without a compress_program then use the best level for this host\n"
+"       --no-config-cache Always parse the config instead of using the parsed config cache\n"
+"       --apply-delta <dir>\n"
+"                         Apply a delta archive, decrypted and decompressed on stdin, to the files under dir\n"
+"                         Apply a target's deltas in order, starting from its last full one\n"
+"       --consolidate     Merge each target's newest delta archive and the ones it builds on into a full one\n"
+"                         which replaces it, reading only the archives (not the target's files)\n"
+"                         With all, targets without delta archives are skipped\n"
+"       --recompress      Rewrite each target's archives older than recompress_after days at recompress_level\n"
+"                         Runs at idle priority, stops at --deadline and continues where it stopped next time\n"
+"       --find <glob>     List the cataloged files matching glob (as excludes match) and their newest archive\n"
+"       --history <path>  List the versions of a cataloged file and the archives holding them\n"
 "       --generate-config\n"
 "                         Generate an example config (for reference)\n"
 "                         If a config file path is specified, that path is used instead\n"
@@ -69,6 +110,40 @@ inline std::string toLower(std::string str) {
 }
 
 
+/* HH:MM is the next time the clock shows it, otherwise a number with an s, m or h suffix from now */
+/* returns 0 if `str` is neither */
+time_t parse_deadline(const std::string &str) {
+  time_t now = time(NULL);
+  int hours = 0;
+  int minutes = 0;
+  char extra = 0;
+  if (std::sscanf(str.c_str(), "%d:%d%c", &hours, &minutes, &extra) == 2) {
+    if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59)
+      return 0;
+    struct tm tm = *localtime(&now);
+    tm.tm_hour = hours;
+    tm.tm_min = minutes;
+    tm.tm_sec = 0;
+    time_t deadline = mktime(&tm);
+    if (deadline <= now) {
+      tm.tm_mday++;
+      deadline = mktime(&tm);
+    }
+    return deadline;
+  }
+
+  double amount = 0;
+  char unit = 0;
+  if (std::sscanf(str.c_str(), "%lf%c%c", &amount, &unit, &extra) != 2 || amount <= 0)
+    return 0;
+  switch (unit) {
+    case 's': return now + (time_t)amount;
+    case 'm': return now + (time_t)(amount * 60);
+    case 'h': return now + (time_t)(amount * 3600);
+  }
+  return 0;
+}
+
 /* i hate argument parsing */
 void parse_args(int argc, char **argv) {
   if (argc == 1) {
@@ -103,6 +178,29 @@ void parse_args(int argc, char **argv) {
       }
       Logger::log(Logger::ERROR, "option --jobs requires argument");
       std::exit(1);
+    } else if (opt == "--target-jobs") {
+      if (++i < argc) {
+        try {
+          options.target_jobs = std::stoi(argv[i]);
+        } catch (...) {
+          Logger::logf(Logger::ERROR, "invalid argument to --target-jobs \"%s\"", argv[i]);
+          std::exit(1);
+        }
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --target-jobs requires argument");
+      std::exit(1);
+    } else if (opt == "--deadline") {
+      if (++i < argc) {
+        options.deadline = parse_deadline(argv[i]);
+        if (options.deadline == 0) {
+          Logger::logf(Logger::ERROR, "invalid argument to --deadline \"%s\" (expected HH:MM or a duration like 90m)", argv[i]);
+          std::exit(1);
+        }
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --deadline requires argument");
+      std::exit(1);
     } else if (opt == "--destdir") {
       if (++i < argc) {
         options.destdir = argv[i];
@@ -110,10 +208,54 @@ void parse_args(int argc, char **argv) {
       }
       Logger::log(Logger::ERROR, "option --destdir requires argument");
       std::exit(1);
+    } else if (opt == "--apply-delta") {
+      if (++i < argc) {
+        options.apply_delta = argv[i];
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --apply-delta requires argument");
+      std::exit(1);
+    } else if (opt == "--log-format") {
+      if (++i < argc) {
+        std::string format = argv[i];
+        if (format == "text") {
+          options.log_format = Logger::LOGFORMAT_TEXT;
+        } else if (format == "json") {
+          options.log_format = Logger::LOGFORMAT_JSON;
+        } else {
+          Logger::logf(Logger::ERROR, "invalid argument to --log-format \"%s\" (expected text or json)", argv[i]);
+          std::exit(1);
+        }
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --log-format requires argument");
+      std::exit(1);
     } else if (opt == "--keep-going") {
       options.keep_going = true;
     } else if (opt == "--print-targets") {
       options.print_targets = true;
+    } else if (opt == "--calibrate") {
+      options.calibrate = true;
+    } else if (opt == "--no-config-cache") {
+      options.use_config_cache = false;
+    } else if (opt == "--find") {
+      if (++i < argc) {
+        options.find = argv[i];
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --find requires argument");
+      std::exit(1);
+    } else if (opt == "--history") {
+      if (++i < argc) {
+        options.history = argv[i];
+        continue;
+      }
+      Logger::log(Logger::ERROR, "option --history requires argument");
+      std::exit(1);
+    } else if (opt == "--consolidate") {
+      options.consolidate = true;
+    } else if (opt == "--recompress") {
+      options.recompress = true;
     } else if (opt == "--generate-config") {
       options.generate_example = true;
     } else {
@@ -219,6 +361,62 @@ void generate_example_config() {
   std::exit(options.targets.size() > 0);
 }
 
+static std::string format_time(int64_t time) {
+  time_t t = time;
+  struct tm tm = *localtime(&t);
+  char buff[128];
+  strftime(buff, sizeof(buff), "%Y-%m-%d %H:%M", &tm);
+  return buff;
+}
+
+/* --find and --history, answered from the catalog alone */
+bool query_catalog() {
+  Catalog catalog{state_directory() / "catalog"};
+  if (!catalog.load()) {
+    Logger::log(Logger::ERROR, "there is no catalog yet (set catalog = true and run backman)");
+    return false;
+  }
+  const std::vector<Catalog::Run> &runs = catalog.get_runs();
+  if (!options.find.empty()) {
+    size_t matches = 0;
+    catalog.find(options.find, [&](const std::string &path, const std::vector<Catalog::Version> &versions) {
+      const Catalog::Run &newest = runs[std::min<size_t>(versions.back().last, runs.size() - 1)];
+      std::printf("%s\t%s\n", path.c_str(), newest.archive.c_str());
+      matches++;
+    });
+    return matches > 0;
+  }
+
+  std::vector<Catalog::Version> versions = catalog.history(options.history);
+  if (versions.empty()) {
+    Logger::logf(Logger::ERROR, "\"%s\" isn't in the catalog", options.history.c_str());
+    return false;
+  }
+  for (const Catalog::Version &version : versions) {
+    if (version.first >= runs.size() || version.last >= runs.size())
+      continue;
+    const Catalog::Run &first = runs[version.first];
+    const Catalog::Run &last = runs[version.last];
+    std::printf("%s to %s  %llu bytes, modified %s  %s%s\n", format_time(first.time).c_str(),
+                format_time(last.time).c_str(), (unsigned long long)version.size,
+                format_time(version.mtime).c_str(), last.archive.c_str(),
+                fs::exists(last.archive) ? "" : " (deleted)");
+  }
+  return true;
+}
+
+/* one cache per config file, so switching between configs with -c doesn't thrash it */
+fs::path config_cache_path() {
+  fs::path cache_dir = resolve_path_with_environment("$XDG_CACHE_HOME/backman");
+  if (std::getenv("XDG_CACHE_HOME") == NULL)
+    cache_dir = resolve_path_with_environment("$HOME/.cache/backman");
+
+  std::error_code ec;
+  fs::path canonical = fs::weakly_canonical(options.config_file, ec);
+  size_t hash = std::hash<std::string>{}(canonical.string());
+  return cache_dir / std::format("config-{}.cache", hash);
+}
+
 int main(int argc, char **argv) {
   options.config_file = resolve_path_with_environment("$XDG_CONFIG_HOME/backman/backman.ini");
   if (std::getenv("XDG_CONFIG_HOME") == NULL)
@@ -226,6 +424,11 @@ int main(int argc, char **argv) {
 
   parse_args(argc, argv);
 
+  Logger::set_logformat(options.log_format);
+  if (options.verbosity > 0)
+    Logger::set_loglevel(Logger::DEBUG);
+  Logger::log_start_async();
+
 #ifndef NDEBUG
   printf(
     "config_file: %s\n"
@@ -245,26 +448,34 @@ int main(int argc, char **argv) {
     generate_example_config();
   }
 
+  if (!options.apply_delta.empty()) {
+    std::exit(!apply_delta(0, options.apply_delta));
+  }
 
+  if (!options.find.empty() || !options.history.empty()) {
+    std::exit(!query_catalog());
+  }
+
+
+  std::vector<fs::path> config_dependencies;
+  bool config_from_cache = false;
   if (fs::exists(options.config_file)) {
-    parsed_config = INI_Parser::ini_parse(options.config_file);
+    if (options.use_config_cache)
+      config_from_cache = INI_Parser::ini_cache_load(config_cache_path(), options.config_file, parsed_config);
+    if (!config_from_cache)
+      parsed_config = INI_Parser::ini_parse(options.config_file, config_dependencies);
   } else {
     Logger::logf(Logger::ERROR, "config file \"%s\" does not exist", options.config_file.c_str());
     std::exit(1);
   }
 
   std::vector<Target> targets;
+  std::vector<INI_Parser::INI_Section> hook_sections;
   for (INI_Parser::INI_Section section : parsed_config) {
     if (section.get_section_name() == "") {
 
-      if (parsed_config[0]["default_dest"].size() == 1)
-        options.destdir = resolve_path_with_environment(parsed_config[0]["default_dest"][0]);
-      else if (parsed_config[0]["default_dest"].size() > 1) {
-        Logger::logf(Logger::ERROR, "default_dest may only be defined once but defined %d times", parsed_config[0]["default_dest"].size());
-        std::exit(1);
-      } else {
-        options.destdir = resolve_path_with_environment("$HOME/Backups");
-      }
+      /* default_dest is applied by the targets without a dest of their own, */
+      /* options.destdir is only for --destdir, which overrides every dest */
 
       if (parsed_config[0]["same_password"].size() == 1) {
         std::string val = toLower(parsed_config[0]["same_password"][0]);
@@ -279,21 +490,97 @@ int main(int argc, char **argv) {
         std::exit(1);
       }
 
+      if (parsed_config[0]["catalog"].size() > 1) {
+        Logger::log(Logger::ERROR, "catalog defined multiple times");
+        std::exit(1);
+      } else if (parsed_config[0]["catalog"].size() == 1) {
+        std::string val = toLower(parsed_config[0]["catalog"][0]);
+        if (val == "true" || val == "false") {
+          options.catalog = val == "true";
+        } else {
+          Logger::logf(Logger::ERROR, "catalog expects a bool (true or false), not \"%s\"", parsed_config[0]["catalog"][0].c_str());
+          std::exit(1);
+        }
+      }
+
+      if (parsed_config[0]["cpu_budget"].size() > 1) {
+        Logger::log(Logger::ERROR, "cpu_budget defined multiple times");
+        std::exit(1);
+      } else if (parsed_config[0]["cpu_budget"].size() == 1) {
+        std::string val = toLower(parsed_config[0]["cpu_budget"][0]);
+        if (val == "auto") {
+          options.cpu_budget = std::max(1u, std::thread::hardware_concurrency());
+        } else {
+          try {
+            options.cpu_budget = std::stoi(val);
+          } catch (...) {
+            options.cpu_budget = -1;
+          }
+          if (options.cpu_budget < 1) {
+            Logger::logf(Logger::ERROR, "cpu_budget expects auto or a number of threads, not \"%s\"", parsed_config[0]["cpu_budget"][0].c_str());
+            std::exit(1);
+          }
+        }
+      }
+
+      if (parsed_config[0]["overlap"].size() > 1) {
+        Logger::log(Logger::ERROR, "overlap defined multiple times");
+        std::exit(1);
+      } else if (parsed_config[0]["overlap"].size() == 1 &&
+                 !InodeClaims::parse_mode(toLower(parsed_config[0]["overlap"][0]), options.overlap)) {
+        Logger::logf(Logger::ERROR, "overlap expects none, report or skip, not \"%s\"", parsed_config[0]["overlap"][0].c_str());
+        std::exit(1);
+      }
+
 
     } else if (section.get_section_name() == "target") {
       targets.emplace_back(section);
+    } else if (section.get_section_name() == "hook") {
+      /* attached once every target exists, a hook may come before its target */
+      hook_sections.push_back(section);
     } else {
       Logger::logf(Logger::WARN, "Invalid section \"%s\", ignoring", section.get_section_name().c_str());
       std::printf("Press enter to continue or ^C to stop: ");
       std::cin.get();
     }
   }
+
+  for (INI_Parser::INI_Section &section : hook_sections) {
+    if (section["target"].size() != 1) {
+      Logger::logf(Logger::ERROR, "target may only be defined once but defined %d times", section["target"].size());
+      std::exit(1);
+    }
+    auto target = std::find_if(targets.begin(), targets.end(), [&](Target &t) { return t.get_name() == section["target"][0]; });
+    if (target == targets.end()) {
+      Logger::logf(Logger::ERROR, "hook for unknown target \"%s\"", section["target"][0].c_str());
+      std::exit(1);
+    }
+    target->add_hook(section);
+  }
+  for (auto &target : targets)
+    target.resolve_hooks();
+
+  /* only cache configs that made it through validation */
+  if (options.use_config_cache && !config_from_cache) {
+    INI_Parser::ini_cache_store(config_cache_path(), options.config_file, config_dependencies, parsed_config);
+  }
+
   if (options.print_targets) {
     std::printf(
       "Config file: %s\n",
       options.config_file.c_str()
     );
-    for (auto target : targets) {
+    for (auto &target : targets) {
+      if (target.get_source_command() != "") {
+        std::printf(
+          "Name: %s\n"
+          "Source command: %s\n"
+          "\n",
+          target.get_name().c_str(),
+          target.get_source_command().c_str()
+        );
+        continue;
+      }
       std::printf(
         "Name: %s\n"
         "Path: %s\n"
@@ -323,7 +610,8 @@ int main(int argc, char **argv) {
   for (size_t i = 0; i < targets.size(); i++) {
     for (size_t j = 0; j < options.targets.size(); j++) {
       if (options.all_targets || targets[i].get_name() == options.targets[j]) {
-        targets[i].set_passphrase();
+        if (!options.calibrate)
+          targets[i].set_passphrase();
         goto next1;
       }
     }
@@ -345,13 +633,86 @@ int main(int argc, char **argv) {
   }
 
 
-  for (auto target : targets) {
-    std::printf("Running %s before hooks\n", target.get_name().c_str());
-    target.run_before_hooks();
-    std::printf("Running %s\n", target.get_name().c_str());
-    target.run_main();
-    target.wait_main();
-    std::printf("Running %s end hooks\n", target.get_name().c_str());
-    target.run_end_hooks();
+  if (options.consolidate) {
+    std::signal(SIGPIPE, SIG_IGN);
+    bool ok = true;
+    for (auto &target : targets) {
+      Logger::set_log_context(target.get_name().c_str());
+      ok = target.consolidate(!options.all_targets) && ok;
+    }
+    Logger::set_log_context(NULL);
+    std::exit(!ok);
   }
+
+  if (options.recompress) {
+    /* a background pass, it yields the cpu and disks to anything else */
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift);
+    std::signal(SIGPIPE, SIG_IGN);
+    bool ok = true;
+    for (auto &target : targets) {
+      Logger::set_log_context(target.get_name().c_str());
+      ok = target.recompress() && ok;
+    }
+    Logger::set_log_context(NULL);
+    std::exit(!ok);
+  }
+
+  Calibration::Store calibration{state_directory()};
+  calibration.load();
+  if (options.calibrate) {
+    for (auto &target : targets) {
+      Logger::set_log_context(target.get_name().c_str());
+      if (!target.has_default_compress_program()) {
+        Logger::log(Logger::INFO, "compress_program is set in the config, not calibrating");
+        continue;
+      }
+      Calibration::Result result = Calibration::calibrate(target);
+      calibration.set(result);
+      int level = 0;
+      int threads = 0;
+      if (Calibration::choose(result, level, threads))
+        std::printf("%s: level %d with %d threads\n", target.get_name().c_str(), level, threads);
+    }
+    Logger::set_log_context(NULL);
+    std::exit(!calibration.save());
+  }
+
+  for (auto &target : targets) {
+    Calibration::Result *result = calibration.get(target.get_name());
+    int level = 0;
+    int threads = 0;
+    if (!target.has_default_compress_program() || result == NULL || !Calibration::choose(*result, level, threads))
+      continue;
+    Compressor compress{target.get_compress_program()};
+    compress.set_level(level);
+    compress.set_threads(threads);
+    target.set_compress_program(compress.get_command());
+    Logger::logf(Logger::DEBUG, "calibrated compress_program for \"%s\" is \"%s\"", target.get_name().c_str(), compress.get_command().c_str());
+  }
+
+  /* a dying reader shows up as EPIPE on the stream it reads, which is handled there */
+  std::signal(SIGPIPE, SIG_IGN);
+
+  /* one set for the whole run, so each target sees what the others archive */
+  if (options.overlap != InodeClaims::NONE) {
+    std::shared_ptr<InodeClaims> claims = std::make_shared<InodeClaims>(options.overlap);
+    for (auto &target : targets)
+      target.set_claims(claims);
+  }
+
+  /* one budget for the whole run, split between the targets that run at once */
+  if (options.cpu_budget > 0) {
+    std::shared_ptr<CpuBudget> budget = std::make_shared<CpuBudget>(options.cpu_budget, options.target_jobs, targets.size());
+    for (auto &target : targets)
+      target.set_cpu_budget(budget);
+  }
+
+  if (Jobserver::setup(options.jobs))
+    std::exit(1);
+
+  History::Store history{state_directory() / "history.ini"};
+  history.load();
+  Scheduler::run_targets(targets, history);
+  history.save();
 }
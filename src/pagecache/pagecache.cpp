@@ -0,0 +1,198 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "pagecache/pagecache.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* how far ahead of tar files are read */
+static constexpr uint64_t readahead_window = 64 << 20;
+/* how far behind tar files are dropped, the stream position is only an estimate */
+static constexpr uint64_t drop_lag = 16 << 20;
+/* what tar writes for a member besides its data: its header and a pax header for */
+/* the xattrs and times, erring high so files are dropped late rather than early */
+static constexpr uint64_t member_overhead = 3 * 512;
+
+static const off_t page_size = sysconf(_SC_PAGESIZE);
+
+static int open_file(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOATIME);
+  if (fd == -1)
+    fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  return fd;
+}
+
+CacheFollower::CacheFollower(const std::vector<MemberList::Member> &members, bool sparse,
+                             std::function<uint64_t()> position)
+    : position(position) {
+  uint64_t offset = 0;
+  for (const MemberList::Member &member : members) {
+    offset += member_overhead;
+    if (member.group != 1)
+      continue;
+    off_t length = member.size;
+    if (sparse && member.allocated < member.size)
+      length = member.allocated;
+    if (length > 0) {
+      File file;
+      file.path = member.path;
+      file.start = offset;
+      file.length = length;
+      this->files.push_back(std::move(file));
+    }
+    /* data is padded to whole blocks */
+    offset += (length + 511) / 512 * 512;
+  }
+}
+
+CacheFollower::~CacheFollower() {
+  this->stop();
+}
+
+void CacheFollower::start() {
+  this->thread = std::thread(&CacheFollower::run, this);
+}
+
+void CacheFollower::stop() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->stopping)
+      return;
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  if (this->thread.joinable())
+    this->thread.join();
+}
+
+void CacheFollower::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (!this->stopping) {
+    lock.unlock();
+    uint64_t position = this->position();
+    this->read_ahead(position);
+    this->drop_behind(position > drop_lag ? position - drop_lag : 0);
+    lock.lock();
+    this->wake.wait_for(lock, std::chrono::milliseconds(50));
+  }
+  lock.unlock();
+  /* tar is done with everything */
+  this->drop_behind(UINT64_MAX);
+}
+
+void CacheFollower::read_ahead(uint64_t position) {
+  uint64_t until = position + readahead_window;
+  while (this->ahead < this->files.size() && this->files[this->ahead].start < until) {
+    File &file = this->files[this->ahead];
+    off_t to = std::min<uint64_t>(file.length, until - file.start);
+    /* stop on a page boundary, or the next call sees the page read ahead here as */
+    /* having been cached before */
+    if (to < file.length)
+      to = to / page_size * page_size;
+    if (to <= file.advised)
+      break;
+    int fd = open_file(file.path);
+    if (fd == -1) {
+      /* gone or unreadable, tar will say so */
+      file.length = 0;
+      this->ahead++;
+      continue;
+    }
+    record_resident(file, fd, file.advised, to);
+    posix_fadvise(fd, file.advised, to - file.advised, POSIX_FADV_WILLNEED);
+    close(fd);
+    file.advised = to;
+    if (file.advised < file.length)
+      break;
+    this->ahead++;
+  }
+}
+
+void CacheFollower::drop_behind(uint64_t position) {
+  while (this->behind < this->files.size() && this->files[this->behind].start < position) {
+    File &file = this->files[this->behind];
+    /* only what was read ahead, the rest was never checked for being cached before */
+    off_t to = std::min<uint64_t>(file.advised, position - file.start);
+    /* DONTNEED keeps partly covered pages, so stop on a page boundary too */
+    if (to < file.length)
+      to = to / page_size * page_size;
+    if (to > file.dropped) {
+      int fd = open_file(file.path);
+      if (fd != -1) {
+        drop(file, fd, file.dropped, to);
+        close(fd);
+      }
+      file.dropped = to;
+    }
+    if (file.dropped < file.length)
+      break;
+    file.resident.clear();
+    file.resident.shrink_to_fit();
+    this->behind++;
+  }
+}
+
+void CacheFollower::record_resident(File &file, int fd, off_t from, off_t to) {
+  const off_t page = page_size;
+  from = from / page * page;
+  if (to <= from)
+    return;
+  void *map = mmap(NULL, to - from, PROT_READ, MAP_SHARED, fd, from);
+  if (map == MAP_FAILED)
+    return;
+  std::vector<unsigned char> pages((to - from + page - 1) / page);
+  if (mincore(map, to - from, pages.data()) == 0) {
+    for (size_t i = 0; i < pages.size(); i++) {
+      if (!(pages[i] & 1))
+        continue;
+      off_t offset = from + (off_t)i * page;
+      if (!file.resident.empty() && file.resident.back().second == offset)
+        file.resident.back().second = offset + page;
+      else
+        file.resident.emplace_back(offset, offset + page);
+    }
+  }
+  munmap(map, to - from);
+}
+
+void CacheFollower::drop(File &file, int fd, off_t from, off_t to) {
+  /* drop [from, to) except where it was cached before */
+  for (const std::pair<off_t, off_t> &range : file.resident) {
+    if (range.second <= from)
+      continue;
+    if (range.first >= to)
+      break;
+    if (range.first > from)
+      posix_fadvise(fd, from, range.first - from, POSIX_FADV_DONTNEED);
+    from = std::max(from, range.second);
+  }
+  /* a length of 0 reaches the end of the file, including its last partial page */
+  if (from < to)
+    posix_fadvise(fd, from, to == file.length ? 0 : to - from, POSIX_FADV_DONTNEED);
+}
@@ -0,0 +1,81 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "walker/members.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* follows tar through its member list so a backup leaves the page cache as it found it */
+/* files are read ahead of tar with WILLNEED and dropped with DONTNEED once tar is past */
+/* them, except for the pages that were already cached before the backup got to them */
+class CacheFollower {
+  public:
+  /* `position` returns how far tar is into the (uncompressed) archive stream */
+  /* `sparse` is whether tar only stores the data of sparse files */
+  CacheFollower(const std::vector<MemberList::Member> &members, bool sparse, std::function<uint64_t()> position);
+
+  CacheFollower(CacheFollower &) = delete;
+
+  ~CacheFollower();
+
+  void start();
+  /* call once tar exited, drops whatever tar read that wasn't dropped yet */
+  void stop();
+
+  private:
+  struct File {
+    std::string                        path;
+    uint64_t                           start;    /* estimated offset of the data in the stream */
+    off_t                              length;   /* bytes tar reads */
+    off_t                              advised = 0;
+    off_t                              dropped = 0;
+    std::vector<std::pair<off_t, off_t>> resident; /* ranges that were cached before */
+  };
+
+  std::vector<File>         files;
+  std::function<uint64_t()> position;
+  size_t                    ahead = 0;  /* first file not fully read ahead */
+  size_t                    behind = 0; /* first file not fully dropped */
+
+  std::thread             thread;
+  std::mutex              mutex;
+  std::condition_variable wake;
+  bool                    stopping = false;
+
+  void run();
+  void read_ahead(uint64_t position);
+  void drop_behind(uint64_t position);
+  static void record_resident(File &file, int fd, off_t from, off_t to);
+  static void drop(File &file, int fd, off_t from, off_t to);
+};
@@ -0,0 +1,218 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "parser/parser.hpp"
+#include "log/log.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <vector>
+
+
+/* bump whenever the layout below changes */
+static constexpr char cache_magic[8] = {'B', 'K', 'M', 'N', 'C', 'F', 'G', '1'};
+
+/*
+ * layout (all integers little endian, as written by the host):
+ *   magic
+ *   string   config file path
+ *   u64      dependency count, then per dependency: string path, i64 mtime (ns, -1 if it didn't exist), u64 size
+ *   u64      section count, then per section: string name, u64 field count, then per field: string field, string value
+ * strings are a u64 length followed by the bytes, without a terminator
+ */
+
+static constexpr int64_t missing_mtime = -1;
+
+struct FileKey {
+  int64_t   mtime_ns = 0;
+  uint64_t      size = 0;
+  bool        exists = false;
+};
+
+static FileKey file_key(const std::filesystem::path &path) {
+  FileKey key;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    key.mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    key.size = st.st_size;
+    key.exists = true;
+  }
+  return key;
+}
+
+static void write_u64(FILE *file, uint64_t value) {
+  fwrite(&value, sizeof(value), 1, file);
+}
+
+static void write_string(FILE *file, const std::string &str) {
+  write_u64(file, str.size());
+  fwrite(str.data(), 1, str.size(), file);
+}
+
+/* the reader works on the whole file in memory, every read is bounds checked */
+class CacheReader {
+  public:
+  CacheReader(std::vector<char> &buffer) : buffer(buffer) {}
+
+  bool read_u64(uint64_t &value) {
+    if (this->offset + sizeof(value) > this->buffer.size())
+      return false;
+    std::memcpy(&value, this->buffer.data() + this->offset, sizeof(value));
+    this->offset += sizeof(value);
+    return true;
+  }
+
+  bool read_string(std::string &str) {
+    uint64_t size = 0;
+    if (!this->read_u64(size) || size > this->buffer.size() - this->offset)
+      return false;
+    str.assign(this->buffer.data() + this->offset, size);
+    this->offset += size;
+    return true;
+  }
+
+  bool read_magic() {
+    if (this->buffer.size() < sizeof(cache_magic) || std::memcmp(this->buffer.data(), cache_magic, sizeof(cache_magic)) != 0)
+      return false;
+    this->offset = sizeof(cache_magic);
+    return true;
+  }
+
+  private:
+  std::vector<char> &buffer;
+  size_t             offset = 0;
+};
+
+bool INI_Parser::ini_cache_load(std::filesystem::path cache_path, std::filesystem::path ini_path, INI_Data &data) {
+  FILE *file = fopen(cache_path.c_str(), "rb");
+  if (file == NULL)
+    return false;
+
+  std::vector<char> buffer;
+  char chunk[65536];
+  size_t got = 0;
+  while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + got);
+  fclose(file);
+
+  CacheReader reader{buffer};
+  if (!reader.read_magic())
+    return false;
+
+  std::error_code ec;
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(ini_path, ec);
+  std::string cached_ini_path;
+  if (!reader.read_string(cached_ini_path) || cached_ini_path != canonical.string())
+    return false;
+
+  uint64_t dependency_count = 0;
+  if (!reader.read_u64(dependency_count))
+    return false;
+  for (uint64_t i = 0; i < dependency_count; i++) {
+    std::string dependency;
+    uint64_t mtime_ns = 0;
+    uint64_t size = 0;
+    if (!reader.read_string(dependency) || !reader.read_u64(mtime_ns) || !reader.read_u64(size))
+      return false;
+    /* an include directory that doesn't exist yet stays valid until it's created */
+    FileKey key = file_key(dependency);
+    if (!key.exists ? mtime_ns != (uint64_t) missing_mtime : (uint64_t) key.mtime_ns != mtime_ns || key.size != size)
+      return false;
+  }
+
+  INI_Data parsed;
+  uint64_t section_count = 0;
+  if (!reader.read_u64(section_count))
+    return false;
+  for (uint64_t i = 0; i < section_count; i++) {
+    std::string section_name;
+    uint64_t field_count = 0;
+    if (!reader.read_string(section_name) || !reader.read_u64(field_count))
+      return false;
+    std::vector<INI_Field> fields;
+    for (uint64_t j = 0; j < field_count; j++) {
+      std::string field;
+      std::string value;
+      if (!reader.read_string(field) || !reader.read_string(value))
+        return false;
+      fields.emplace_back(field, value);
+    }
+    parsed.emplace_back(section_name, std::move(fields));
+  }
+
+  data = std::move(parsed);
+  return true;
+}
+
+bool INI_Parser::ini_cache_store(std::filesystem::path cache_path, std::filesystem::path ini_path, const std::vector<std::filesystem::path> &dependencies, const INI_Data &data) {
+  std::error_code ec;
+  std::filesystem::create_directories(cache_path.parent_path(), ec);
+  if (ec) {
+    Logger::logf(Logger::WARN, "can't create config cache directory \"%s\"", cache_path.parent_path().c_str());
+    return false;
+  }
+
+  /* written next to the real cache and renamed over it so readers never see half a cache */
+  std::filesystem::path tmp_path = cache_path;
+  tmp_path += ".tmp";
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (file == NULL) {
+    Logger::logf(Logger::WARN, "can't write config cache \"%s\"", tmp_path.c_str());
+    return false;
+  }
+
+  fwrite(cache_magic, 1, sizeof(cache_magic), file);
+  write_string(file, std::filesystem::weakly_canonical(ini_path, ec).string());
+
+  write_u64(file, dependencies.size());
+  for (const std::filesystem::path &dependency : dependencies) {
+    FileKey key = file_key(dependency);
+    write_string(file, dependency.string());
+    write_u64(file, key.exists ? key.mtime_ns : missing_mtime);
+    write_u64(file, key.size);
+  }
+
+  write_u64(file, data.size());
+  for (const INI_Section &section : data) {
+    write_string(file, section.get_section_name());
+    write_u64(file, section.get_fields().size());
+    for (const INI_Field &field : section.get_fields()) {
+      write_string(file, field.get_field());
+      write_string(file, field.get_value());
+    }
+  }
+
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+  if (!ok || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    Logger::logf(Logger::WARN, "can't write config cache \"%s\"", cache_path.c_str());
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  return true;
+}
@@ -27,6 +27,8 @@
 #include <cstddef>
 #include <cstdio>
 #include <filesystem>
+#include <fstream>
+#include <glob.h>
 #include <stdexcept>
 #include <string>
 #include <unistd.h>
@@ -74,6 +76,11 @@ inline std::string& trim(std::string& s, const char* t = ws)
 /* End borrowed code */
 
 
+INI_Parser::INI_Field::INI_Field(std::string field, std::string value) {
+  this->_field = field;
+  this->_value = value;
+}
+
 INI_Parser::INI_Field::INI_Field(std::string line) {
   trim(line);
 
@@ -125,7 +132,7 @@ INI_Parser::INI_Field::INI_Field(std::string line) {
 }
 
 
-std::string INI_Parser::INI_Field::get_field() {
+std::string INI_Parser::INI_Field::get_field() const {
   return _field;
 }
 
@@ -133,6 +140,10 @@ std::string &INI_Parser::INI_Field::get_value() {
   return _value;
 }
 
+const std::string &INI_Parser::INI_Field::get_value() const {
+  return _value;
+}
+
 bool is_comment_or_empty(std::string line) {
   trim(line);
   return line.size() == 0 || line[0] == ';' || line[0] == '#';
@@ -204,9 +215,15 @@ INI_Parser::INI_Section::INI_Section(std::vector<std::string> &lines, std::size_
 }
 
 
+INI_Parser::INI_Section::INI_Section(std::string section_name, std::vector<INI_Field> fields) {
+  _section_name = section_name;
+  _fields = std::move(fields);
+}
+
+
 std::vector<std::string> INI_Parser::INI_Section::operator[](std::string field_name) const {
   std::vector<std::string> ret;
-  for (auto field : _fields) {
+  for (auto &field : _fields) {
     if (field.get_field() == field_name) {
       ret.push_back(field.get_value());
     }
@@ -214,32 +231,102 @@ std::vector<std::string> INI_Parser::INI_Section::operator[](std::string field_n
   return ret;
 }
 
-std::string INI_Parser::INI_Section::get_section_name() {
+std::string INI_Parser::INI_Section::get_section_name() const {
   return _section_name;
 }
 
-std::vector<INI_Parser::INI_Section> INI_Parser::ini_parse(std::filesystem::path ini_path) {
-  if (std::filesystem::exists(ini_path)) {
-    std::string file_string = "";
-    FILE *file = fopen(ini_path.c_str(), "rb");
-    if (file == NULL) {
-      throw std::runtime_error("config file not found");
+const std::vector<INI_Parser::INI_Field> &INI_Parser::INI_Section::get_fields() const {
+  return _fields;
+}
+
+/* reads `path` line by line into `lines`, splicing in the files matched by include lines */
+static void read_lines(const std::filesystem::path &path, std::vector<std::string> &lines, std::vector<std::filesystem::path> &dependencies, std::vector<std::filesystem::path> &include_stack) {
+  std::error_code ec;
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+  if (ec)
+    canonical = path;
+
+  for (const std::filesystem::path &p : include_stack) {
+    if (p == canonical) {
+      Logger::logf(Logger::WARN, "\"%s\" includes itself, ignoring", path.c_str());
+      return;
+    }
+  }
+
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    throw std::runtime_error("config file not found");
+  }
+  dependencies.push_back(canonical);
+  include_stack.push_back(canonical);
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (is_comment_or_empty(line) || line[line.find_first_not_of(" \t\r")] == '[') {
+      lines.push_back(line);
+      continue;
     }
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    char *buff = (char *) malloc(size);
 
-    fseek(file, 0, SEEK_SET);
-    fread(buff, 1, size, file);
+    std::string field;
+    std::string pattern;
+    try {
+      INI_Parser::INI_Field parsed{line};
+      field = parsed.get_field();
+      pattern = parsed.get_value();
+    } catch (std::runtime_error &e) {
+      /* let INI_Section report it */
+      lines.push_back(line);
+      continue;
+    }
+    if (field != "include") {
+      lines.push_back(line);
+      continue;
+    }
 
-    file_string = buff;
+    std::filesystem::path include_pattern = pattern;
+    if (include_pattern.is_relative())
+      include_pattern = canonical.parent_path() / include_pattern;
+
+    /* files added to or removed from the include directory change its mtime, */
+    /* and one that doesn't exist is recorded as missing until it does */
+    std::filesystem::path include_dir = include_pattern.parent_path();
+    if (include_dir.string().find_first_of("*?[") == std::string::npos)
+      dependencies.push_back(include_dir);
+
+    glob_t matches;
+    int ret = glob(include_pattern.c_str(), 0, NULL, &matches);
+    if (ret == GLOB_NOMATCH) {
+      Logger::logf(Logger::WARN, "include \"%s\" matched no files", pattern.c_str());
+    } else if (ret != 0) {
+      Logger::logf(Logger::WARN, "include \"%s\" could not be expanded", pattern.c_str());
+    } else {
+      for (size_t i = 0; i < matches.gl_pathc; i++) {
+        std::filesystem::path match = matches.gl_pathv[i];
+        if (std::filesystem::is_directory(match))
+          continue;
+        read_lines(match, lines, dependencies, include_stack);
+      }
+    }
+    globfree(&matches);
+  }
 
-    free(buff);
+  include_stack.pop_back();
+}
 
-    return INI_Parser::ini_parse(file_string);
-  } else {
+std::vector<INI_Parser::INI_Section> INI_Parser::ini_parse(std::filesystem::path ini_path, std::vector<std::filesystem::path> &dependencies) {
+  if (!std::filesystem::exists(ini_path)) {
     throw std::runtime_error("config file not found");
   }
+  std::vector<std::string> lines;
+  std::vector<std::filesystem::path> include_stack;
+  read_lines(ini_path, lines, dependencies, include_stack);
+
+  return INI_Parser::ini_parse(lines);
+}
+
+std::vector<INI_Parser::INI_Section> INI_Parser::ini_parse(std::filesystem::path ini_path) {
+  std::vector<std::filesystem::path> dependencies;
+  return INI_Parser::ini_parse(ini_path, dependencies);
 }
 
 std::vector<std::string> split(std::string str, const std::string delim) {
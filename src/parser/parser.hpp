@@ -36,9 +36,11 @@ namespace INI_Parser {
 
         public:
         INI_Field(std::string line);
+        INI_Field(std::string field, std::string value);
 
-        std::string get_field();
+        std::string get_field() const;
         std::string &get_value();
+        const std::string &get_value() const;
 
 
         private:
@@ -57,12 +59,17 @@ namespace INI_Parser {
         /* if there is no other section, current_line will equal lines.size() */
         INI_Section(std::vector<std::string> &lines, std::size_t &current_line, bool section_global = false);
 
+        /* builds a section out of already parsed fields (used when loading the config cache) */
+        INI_Section(std::string section_name, std::vector<INI_Field> fields);
+
         /* returns the value of the field contained inside the field with the name `field` */
         /* returns an empty string if the field is not found (or field's value is an empty string) */
         /* returns the *first* found result */
         std::vector<std::string> operator[](std::string field) const;
 
-        std::string get_section_name();
+        std::string get_section_name() const;
+
+        const std::vector<INI_Field> &get_fields() const;
 
         private:
 
@@ -85,5 +92,20 @@ namespace INI_Parser {
     INI_Data ini_parse(std::vector<std::string> ini_source);
 
     /* accepts the path to the ini */
+    /* lines of the form `include = <glob>` are replaced by the contents of every matching file */
+    /* (sorted, relative to the directory of the including file) */
     INI_Data ini_parse(std::filesystem::path ini_path);
+
+    /* same as above, but also appends every file and directory the result was read from to `dependencies` */
+    INI_Data ini_parse(std::filesystem::path ini_path, std::vector<std::filesystem::path> &dependencies);
+
+
+    /* the config cache is a compact binary copy of the parsed config */
+    /* it is only valid while the mtime and size of all of its dependencies are unchanged */
+
+    /* returns false if the cache is missing, stale, or was made for a different config file */
+    bool ini_cache_load(std::filesystem::path cache_path, std::filesystem::path ini_path, INI_Data &data);
+
+    /* returns false if the cache could not be written, which is never fatal */
+    bool ini_cache_store(std::filesystem::path cache_path, std::filesystem::path ini_path, const std::vector<std::filesystem::path> &dependencies, const INI_Data &data);
 }
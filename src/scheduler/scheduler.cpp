@@ -0,0 +1,244 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "scheduler/scheduler.hpp"
+#include "jobserver/jobserver.hpp"
+#include "log/log.h"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+/* list schedules `order` on `slots` parallel slots and returns when the last one finishes */
+static double predict_makespan(const std::vector<size_t> &order, const std::vector<double> &durations, int slots) {
+  std::vector<double> finish(std::max(slots, 1), 0);
+  for (size_t i : order) {
+    *std::min_element(finish.begin(), finish.end()) += std::max(durations[i], 0.0);
+  }
+  return *std::max_element(finish.begin(), finish.end());
+}
+
+/* longest processing time first, targets without history go first as they could be anything */
+static std::vector<size_t> order_targets(const std::vector<double> &durations) {
+  std::vector<size_t> order(durations.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (options.target_jobs > 1) {
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      double da = durations[a] < 0 ? 1e300 : durations[a];
+      double db = durations[b] < 0 ? 1e300 : durations[b];
+      return da > db;
+    });
+  }
+  return order;
+}
+
+/* held shared by every phase of every target while it runs, */
+/* alone by a phase with an exclusive hook so nothing overlaps it */
+static std::shared_mutex overlap;
+
+static void run_phase(bool exclusive, const std::function<void()> &phase) {
+  if (exclusive) {
+    std::unique_lock lock(overlap);
+    phase();
+  } else {
+    std::shared_lock lock(overlap);
+    phase();
+  }
+}
+
+/* `before_main` is called between the before hooks and the main run, `after_main` right after it */
+/* the recorded duration is the time spent in the phases, not waiting for `before_main` or a phase's turn */
+static void run_target(Target &target, History::Store &history,
+                       const std::function<void()> &before_main = nullptr,
+                       const std::function<void()> &after_main = nullptr) {
+  Logger::set_log_context(target.get_name().c_str());
+
+  time_t start_time = time(NULL);
+  double duration = 0;
+  auto timed = [&](const std::function<void()> &phase) {
+    return [&duration, phase]() {
+      auto start = std::chrono::steady_clock::now();
+      phase();
+      duration += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+  };
+
+  auto predict = [&](const std::string &hook) {
+    return history.predict_hook_duration(target.get_name(), hook);
+  };
+  std::vector<std::pair<std::string, double>> hooks;
+
+  run_phase(target.has_exclusive_hook(false), timed([&]() {
+    std::printf("Running %s before hooks\n", target.get_name().c_str());
+    target.run_before_hooks(predict);
+    hooks = target.get_hook_durations();
+  }));
+  if (before_main)
+    before_main();
+  run_phase(false, [&]() {
+    /* a caller's slots are shared by targets too, ours only by hooks and children */
+    Jobserver::Slot slot;
+    if (Jobserver::is_client())
+      slot = Jobserver::acquire();
+    timed([&]() {
+      std::printf("Running %s\n", target.get_name().c_str());
+      target.run_main();
+      target.wait_main();
+    })();
+    if (Jobserver::is_client())
+      Jobserver::release(slot);
+  });
+  if (after_main)
+    after_main();
+  run_phase(target.has_exclusive_hook(true), timed([&]() {
+    std::printf("Running %s end hooks\n", target.get_name().c_str());
+    target.run_end_hooks(predict);
+    for (auto &hook : target.get_hook_durations())
+      hooks.push_back(hook);
+  }));
+
+  History::Record record;
+  record.target = target.get_name();
+  record.start = start_time;
+  record.duration = duration;
+  record.bytes_in = target.get_bytes_in();
+  record.bytes_out = target.get_bytes_out();
+  record.fast = target.is_compression_lowered();
+  record.hooks = hooks;
+  history.add(record);
+
+  /* ratio and throughput, to compare compress_program and order settings by */
+  double ratio = record.bytes_out > 0 ? (double)record.bytes_in / record.bytes_out : 0;
+  double throughput = record.duration > 0 ? record.bytes_in / record.duration / (1 << 20) : 0;
+  Logger::logf(Logger::INFO, "finished in %.1fs, %llu bytes in, %llu bytes out, ratio %.3f, %.1f MiB/s",
+               record.duration, (unsigned long long)record.bytes_in, (unsigned long long)record.bytes_out,
+               ratio, throughput);
+  Logger::set_log_context(NULL);
+}
+
+void Scheduler::run_targets(std::vector<Target> &targets, History::Store &history) {
+  std::vector<double> durations;
+  for (Target &target : targets) {
+    durations.push_back(history.predict_duration(target.get_name(), false));
+  }
+  std::vector<size_t> order = order_targets(durations);
+
+  if (options.deadline != 0) {
+    double remaining = difftime(options.deadline, time(NULL));
+    for (size_t i = 0; i < targets.size(); i++) {
+      if (durations[i] < 0)
+        Logger::logf(Logger::WARN, "no history for target \"%s\", the deadline prediction ignores it", targets[i].get_name().c_str());
+    }
+
+    double makespan = predict_makespan(order, durations, options.target_jobs);
+    /* lower the target which saves the most until the run fits */
+    /* targets whose compress_program can't be lowered are passed over for the next best */
+    std::vector<bool> tried(targets.size(), false);
+    while (makespan > remaining) {
+      size_t best = targets.size();
+      double best_saving = 0;
+      for (size_t i = 0; i < targets.size(); i++) {
+        if (durations[i] < 0 || tried[i] || targets[i].is_compression_lowered())
+          continue;
+        double saving = durations[i] - history.predict_duration(targets[i].get_name(), true);
+        if (saving > best_saving) {
+          best = i;
+          best_saving = saving;
+        }
+      }
+      if (best == targets.size())
+        break;
+      tried[best] = true;
+      if (!targets[best].lower_compression())
+        continue;
+      durations[best] -= best_saving;
+      Logger::logf(Logger::WARN, "lowering compression of \"%s\" to make the deadline", targets[best].get_name().c_str());
+      order = order_targets(durations);
+      makespan = predict_makespan(order, durations, options.target_jobs);
+    }
+
+    if (makespan > remaining)
+      Logger::logf(Logger::WARN, "run is predicted to miss the deadline by %.0fs", makespan - remaining);
+    else
+      Logger::logf(Logger::INFO, "run is predicted to finish %.0fs before the deadline", remaining - makespan);
+  }
+
+  if (options.target_jobs <= 1) {
+    /* one main run at a time, but the next target's before hooks run during it */
+    /* (from when it starts) and so do the previous target's end hooks */
+    std::mutex lock;
+    std::condition_variable changed;
+    size_t started = 0;  /* main runs started */
+    size_t finished = 0; /* main runs finished */
+    auto wait_for = [&](const size_t &count, size_t value) {
+      std::unique_lock guard(lock);
+      changed.wait(guard, [&]() { return count >= value; });
+    };
+    auto set = [&](size_t &count, size_t value) {
+      std::lock_guard guard(lock);
+      count = value;
+      changed.notify_all();
+    };
+
+    /* a target's thread is only started once it may run, when the previous main run starts */
+    std::vector<std::thread> pipeline;
+    for (size_t j = 0; j < order.size(); j++) {
+      wait_for(started, j);
+      pipeline.emplace_back([&, j]() {
+        run_target(targets[order[j]], history,
+                   [&]() {
+                     wait_for(finished, j);
+                     set(started, j + 1);
+                   },
+                   [&]() { set(finished, j + 1); });
+      });
+    }
+    for (std::thread &thread : pipeline) {
+      thread.join();
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> workers;
+  for (int i = 0; i < options.target_jobs && (size_t)i < targets.size(); i++) {
+    workers.emplace_back([&]() {
+      for (size_t j = next++; j < order.size(); j = next++) {
+        run_target(targets[order[j]], history);
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
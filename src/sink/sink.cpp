@@ -0,0 +1,209 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "sink/sink.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* what a single stream may buffer */
+static constexpr size_t stream_buffer_size = 64 << 20;
+
+CommandSink::CommandSink(const std::string &command,
+                         const std::vector<std::pair<std::string, std::string>> &environment,
+                         uint64_t part_size, unsigned parallel)
+    : command(command), environment(environment), part_size(part_size),
+      parallel(part_size > 0 ? std::max(parallel, 1u) : 1) {
+  this->buffer_size = part_size > 0 ? part_size : stream_buffer_size;
+}
+
+CommandSink::~CommandSink() {
+  this->finish();
+}
+
+uint64_t CommandSink::get_bytes() { return this->bytes; }
+
+std::string CommandSink::get_command() { return this->command; }
+
+bool CommandSink::start_part(std::unique_lock<std::mutex> &lock) {
+  /* wait for a free slot */
+  this->changed.wait(lock, [&] {
+    return std::count_if(this->parts.begin(), this->parts.end(), [](const auto &part) { return !part->done; }) <
+           (long)this->parallel;
+  });
+
+  auto part = std::make_unique<Part>();
+  part->index = this->parts.size();
+  part->offset = this->bytes;
+
+  int pipefds[2];
+  if (pipe2(pipefds, O_CLOEXEC) == -1) {
+    Logger::logf(Logger::ERROR, "pipe() call failed: %s", strerror(errno));
+    return false;
+  }
+  part->process.set_executable("/bin/sh");
+  part->process.add_argument("-c");
+  part->process.add_argument(this->command);
+  for (const auto &variable : this->environment)
+    part->process.set_environment(variable.first, variable.second);
+  if (this->part_size > 0) {
+    part->process.set_environment("BACKMAN_PART", std::to_string(part->index));
+    part->process.set_environment("BACKMAN_PART_OFFSET", std::to_string(part->offset));
+  }
+  part->process.redirect(pipefds[0], 0);
+  bool spawn_failed = part->process.run();
+  close(pipefds[0]);
+  if (spawn_failed) {
+    Logger::logf(Logger::ERROR, "running dest_command \"%s\" failed", this->command.c_str());
+    close(pipefds[1]);
+    return false;
+  }
+  part->fd = pipefds[1];
+  part->thread = std::thread(&CommandSink::run_part, this, std::ref(*part));
+  this->current = part.get();
+  this->parts.push_back(std::move(part));
+  return true;
+}
+
+void CommandSink::run_part(Part &part) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  for (;;) {
+    this->changed.wait(lock, [&] { return !part.queue.empty() || part.closed; });
+    if (part.queue.empty())
+      break;
+    std::vector<char> chunk = std::move(part.queue.front());
+    part.queue.pop_front();
+    lock.unlock();
+
+    bool ok = true;
+    for (size_t written = 0; ok && written < chunk.size();) {
+      ssize_t ret = ::write(part.fd, chunk.data() + written, chunk.size() - written);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1) {
+        /* EPIPE is the command exiting early, its exit code says why */
+        if (errno != EPIPE)
+          Logger::logf(Logger::ERROR, "writing to dest_command failed: %s", strerror(errno));
+        ok = false;
+        break;
+      }
+      written += ret;
+    }
+
+    lock.lock();
+    part.queued -= chunk.size();
+    this->changed.notify_all();
+    if (!ok) {
+      part.failed = true;
+      break;
+    }
+  }
+  lock.unlock();
+
+  close(part.fd);
+  part.fd = -1;
+  int exit_code = part.process.join();
+
+  lock.lock();
+  part.exit_code = exit_code;
+  if (exit_code != 0)
+    part.failed = true;
+  if (part.failed)
+    this->failed = true;
+  /* nothing more will be read, drop the rest */
+  part.queue.clear();
+  part.queued = 0;
+  part.done = true;
+  this->changed.notify_all();
+}
+
+bool CommandSink::write(const char *data, size_t length) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (length > 0) {
+    if (this->failed)
+      return false;
+    if (this->current == NULL || (this->part_size > 0 && this->current->bytes == this->part_size)) {
+      if (this->current != NULL) {
+        this->current->closed = true;
+        this->changed.notify_all();
+      }
+      if (!this->start_part(lock)) {
+        this->failed = true;
+        return false;
+      }
+    }
+    Part &part = *this->current;
+    size_t take = length;
+    if (this->part_size > 0)
+      take = std::min<uint64_t>(take, this->part_size - part.bytes);
+
+    this->changed.wait(lock, [&] { return part.queued + take <= this->buffer_size || part.queued == 0 || part.done; });
+    if (part.done) {
+      this->failed = true;
+      return false;
+    }
+    part.queue.emplace_back(data, data + take);
+    part.queued += take;
+    part.bytes += take;
+    this->bytes += take;
+    data += take;
+    length -= take;
+    this->changed.notify_all();
+  }
+  return true;
+}
+
+bool CommandSink::finish() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if (this->finished)
+    return !this->failed;
+  this->finished = true;
+  /* an empty archive still gets a run of the command */
+  if (this->current == NULL && !this->failed && !this->start_part(lock))
+    this->failed = true;
+  for (auto &part : this->parts)
+    part->closed = true;
+  this->changed.notify_all();
+  this->changed.wait(lock, [&] {
+    return std::all_of(this->parts.begin(), this->parts.end(), [](const auto &part) { return part->done; });
+  });
+  lock.unlock();
+
+  for (auto &part : this->parts) {
+    if (part->thread.joinable())
+      part->thread.join();
+    if (this->part_size > 0) {
+      Logger::logf(part->failed ? Logger::ERROR : Logger::INFO,
+                   "dest_command \"%s\" part %u: %llu bytes at %llu, exit %d", this->command.c_str(), part->index,
+                   (unsigned long long)part->bytes, (unsigned long long)part->offset, part->exit_code);
+    } else {
+      Logger::logf(part->failed ? Logger::ERROR : Logger::INFO, "dest_command \"%s\": %llu bytes, exit %d",
+                   this->command.c_str(), (unsigned long long)part->bytes, part->exit_code);
+    }
+  }
+  return !this->failed;
+}
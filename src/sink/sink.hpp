@@ -0,0 +1,91 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "subprocess/subprocess.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* an archive destination that is a command reading the archive on its stdin, run as */
+/* `/bin/sh -c command` (`ssh host 'cat > backup'`, an object store uploader, ...) */
+/* large archives can be split in parts of `part_size` bytes, each streamed to its own run */
+/* of the command, up to `parallel` at once; every running part buffers at most */
+/* `part_size` (64MiB without parts) in memory */
+class CommandSink {
+  public:
+  CommandSink(const std::string &command, const std::vector<std::pair<std::string, std::string>> &environment,
+              uint64_t part_size, unsigned parallel);
+
+  CommandSink(CommandSink &) = delete;
+
+  ~CommandSink();
+
+  /* blocks while the buffers are full, returns false once a part failed */
+  bool     write(const char *data, size_t length);
+  /* ends the stream, waits for every part and logs how each went, returns false if any failed */
+  bool     finish();
+  uint64_t get_bytes();
+  std::string get_command();
+
+  private:
+  struct Part {
+    unsigned                      index;
+    uint64_t                      offset; /* of the part in the archive */
+    uint64_t                      bytes = 0;
+    Subprocess                    process;
+    int                           fd = -1;
+    std::deque<std::vector<char>> queue;
+    size_t                        queued = 0;
+    bool                          closed = false;
+    bool                          done = false;
+    bool                          failed = false;
+    int                           exit_code = -1;
+    std::thread                   thread;
+  };
+
+  std::string                                      command;
+  std::vector<std::pair<std::string, std::string>> environment;
+  uint64_t                                         part_size;
+  unsigned                                         parallel;
+  size_t                                           buffer_size;
+  uint64_t                                         bytes = 0;
+  bool                                             failed = false;
+  bool                                             finished = false;
+
+  std::vector<std::unique_ptr<Part>> parts;
+  Part                              *current = NULL;
+  std::mutex                         mutex;
+  std::condition_variable            changed;
+
+  bool start_part(std::unique_lock<std::mutex> &lock);
+  void run_part(Part &part);
+};
@@ -0,0 +1,355 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "snapshot/snapshot.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+Snapshot::Snapshot(const fs::path &root, const std::string &date,
+                   const fs::path &source, bool sparse)
+    : root(root), date(date), source(source), sparse(sparse) {
+  this->partial = root / (date + ".partial");
+}
+
+uint64_t Snapshot::get_bytes_in() { return this->bytes_in; }
+
+uint64_t Snapshot::get_bytes_copied() { return this->bytes_copied; }
+
+/* the newest finished snapshot, which may be today's when run again */
+fs::path Snapshot::find_previous() {
+  std::string newest;
+  std::error_code ec;
+  for (const fs::directory_entry &entry : fs::directory_iterator(this->root, ec)) {
+    std::string name = entry.path().filename().string();
+    if (!entry.is_directory(ec) || name.find('.') != std::string::npos)
+      continue;
+    newest = std::max(newest, name);
+  }
+  return newest.empty() ? fs::path() : this->root / newest;
+}
+
+fs::path Snapshot::relative(const std::string &path) {
+  std::string source = this->source.string();
+  std::string rest = path.substr(std::min(path.size(), source.size()));
+  while (!rest.empty() && rest[0] == '/')
+    rest.erase(0, 1);
+  return rest;
+}
+
+static void copy_xattrs(int from, int to, const char *path) {
+  ssize_t size = flistxattr(from, NULL, 0);
+  if (size <= 0)
+    return;
+  std::string names(size, '\0');
+  size = flistxattr(from, names.data(), names.size());
+  if (size <= 0)
+    return;
+  std::string value;
+  for (size_t i = 0; i < (size_t)size; i += std::strlen(names.c_str() + i) + 1) {
+    const char *name = names.c_str() + i;
+    ssize_t length = fgetxattr(from, name, NULL, 0);
+    if (length < 0)
+      continue;
+    value.resize(length);
+    length = fgetxattr(from, name, value.data(), value.size());
+    if (length < 0 || fsetxattr(to, name, value.data(), length, 0) == -1) {
+      /* security.* and trusted.* need privileges, like tar it's not an error */
+      Logger::logf(Logger::DEBUG, "can't copy xattr %s of \"%s\": %s", name, path, strerror(errno));
+    }
+  }
+}
+
+static void set_metadata(int fd, const struct stat &st) {
+  /* chown first, it clears the setuid and setgid bits */
+  if (geteuid() == 0)
+    fchown(fd, st.st_uid, st.st_gid);
+  fchmod(fd, st.st_mode & 07777);
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  futimens(fd, times);
+}
+
+/* copies [offset, offset + length), in the kernel when it can, false on a read or write error */
+static bool copy_range(int in, int out, off_t offset, off_t length, uint64_t &copied) {
+  off_t in_offset = offset;
+  off_t out_offset = offset;
+  while (length > 0) {
+    ssize_t n = copy_file_range(in, &in_offset, out, &out_offset, length, 0);
+    if (n == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+      break;
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return false;
+    if (n == 0) /* the file shrank */
+      return true;
+    copied += n;
+    length -= n;
+  }
+  char buffer[1 << 16];
+  while (length > 0) {
+    ssize_t n = pread(in, buffer, std::min<off_t>(sizeof(buffer), length), in_offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return n == 0;
+    if (pwrite(out, buffer, n, out_offset) != n)
+      return false;
+    in_offset += n;
+    out_offset += n;
+    copied += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool Snapshot::take(Walker &walker) {
+  std::error_code ec;
+  /* left by an interrupted run */
+  fs::remove_all(this->partial, ec);
+  fs::create_directories(this->root, ec);
+  this->previous = this->find_previous();
+  if (!this->previous.empty())
+    Logger::logf(Logger::DEBUG, "linking unchanged files to \"%s\"", this->previous.c_str());
+
+  if (mkdir(this->partial.c_str(), 0700) == -1) {
+    Logger::logf(Logger::ERROR, "can't create \"%s\": %s", this->partial.c_str(), strerror(errno));
+    return false;
+  }
+
+  walker.walk([this](const Walker::Entry &entry) { this->add(entry); });
+
+  /* deepest first, so writing a directory's contents doesn't touch its times again */
+  for (auto it = this->directories.rbegin(); it != this->directories.rend(); it++) {
+    int fd = open(it->first.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+      continue;
+    set_metadata(fd, it->second);
+    close(fd);
+  }
+
+  fs::path finished = this->root / this->date;
+  fs::path replaced = this->root / (this->date + ".old");
+  fs::remove_all(replaced, ec);
+  if (fs::exists(finished, ec) && rename(finished.c_str(), replaced.c_str()) == -1) {
+    Logger::logf(Logger::ERROR, "can't replace \"%s\": %s", finished.c_str(), strerror(errno));
+    return false;
+  }
+  if (rename(this->partial.c_str(), finished.c_str()) == -1) {
+    Logger::logf(Logger::ERROR, "can't rename \"%s\": %s", this->partial.c_str(), strerror(errno));
+    return false;
+  }
+  fs::remove_all(replaced, ec);
+
+  Logger::logf(Logger::INFO, "snapshot \"%s\": %zu files linked, %zu copied (%llu bytes)%s",
+               finished.c_str(), this->linked, this->copied,
+               (unsigned long long)this->bytes_copied,
+               this->failed ? ", some entries failed" : "");
+  return this->failed == 0;
+}
+
+void Snapshot::add(const Walker::Entry &entry) {
+  fs::path relative = this->relative(entry.path);
+  /* a target whose path is a file snapshots just that file */
+  if (relative.empty() && !S_ISDIR(entry.st.st_mode))
+    relative = fs::path(entry.path).filename();
+  fs::path destination = relative.empty() ? this->partial : this->partial / relative;
+  const struct stat &st = entry.st;
+
+  if (S_ISDIR(st.st_mode)) {
+    if (!relative.empty() && mkdir(destination.c_str(), 0700) == -1) {
+      Logger::logf(Logger::WARN, "can't create \"%s\": %s", destination.c_str(), strerror(errno));
+      this->failed++;
+      return;
+    }
+    int from = openat(entry.dirfd, entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int to = open(destination.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (from != -1 && to != -1)
+      copy_xattrs(from, to, entry.path.c_str());
+    if (from != -1)
+      close(from);
+    if (to != -1)
+      close(to);
+    this->directories.emplace_back(destination, st);
+    return;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    this->bytes_in += st.st_size;
+    this->add_file(entry, relative, destination);
+    return;
+  }
+
+  bool ok = true;
+  if (S_ISLNK(st.st_mode)) {
+    std::string target(st.st_size > 0 ? st.st_size + 1 : PATH_MAX, '\0');
+    ssize_t length = readlinkat(entry.dirfd, entry.name, target.data(), target.size());
+    ok = length >= 0;
+    if (ok) {
+      target.resize(length);
+      ok = symlink(target.c_str(), destination.c_str()) == 0;
+    }
+    if (ok) {
+      if (geteuid() == 0)
+        lchown(destination.c_str(), st.st_uid, st.st_gid);
+      struct timespec times[2] = {st.st_atim, st.st_mtim};
+      utimensat(AT_FDCWD, destination.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    }
+  } else if (S_ISSOCK(st.st_mode)) {
+    /* like tar */
+    Logger::logf(Logger::DEBUG, "\"%s\": socket ignored", entry.path.c_str());
+    return;
+  } else {
+    /* fifos, and devices when root */
+    ok = mknod(destination.c_str(), st.st_mode, st.st_rdev) == 0;
+    if (ok) {
+      if (geteuid() == 0)
+        lchown(destination.c_str(), st.st_uid, st.st_gid);
+      chmod(destination.c_str(), st.st_mode & 07777);
+      struct timespec times[2] = {st.st_atim, st.st_mtim};
+      utimensat(AT_FDCWD, destination.c_str(), times, 0);
+    }
+  }
+  if (!ok) {
+    Logger::logf(Logger::WARN, "can't create \"%s\": %s", destination.c_str(), strerror(errno));
+    this->failed++;
+  }
+}
+
+void Snapshot::add_file(const Walker::Entry &entry, const fs::path &relative,
+                        const fs::path &destination) {
+  const struct stat &st = entry.st;
+  /* the other links to a file already in this snapshot */
+  if (st.st_nlink > 1) {
+    auto key = std::make_pair(st.st_dev, st.st_ino);
+    auto first = this->links.find(key);
+    if (first != this->links.end() && link(first->second.c_str(), destination.c_str()) == 0)
+      return;
+    this->links[key] = destination;
+  }
+
+  if (this->link_previous(st, relative, destination)) {
+    this->linked++;
+    return;
+  }
+  if (!this->copy_file(entry, destination)) {
+    this->failed++;
+    return;
+  }
+  this->copied++;
+}
+
+/* links (or reflinks) the previous snapshot's copy if the file looks unchanged */
+bool Snapshot::link_previous(const struct stat &st, const fs::path &relative,
+                             const fs::path &destination) {
+  if (this->previous.empty())
+    return false;
+  fs::path old = this->previous / relative;
+  struct stat old_st;
+  if (lstat(old.c_str(), &old_st) == -1 || !S_ISREG(old_st.st_mode) ||
+      old_st.st_size != st.st_size || old_st.st_mtim.tv_sec != st.st_mtim.tv_sec ||
+      old_st.st_mtim.tv_nsec != st.st_mtim.tv_nsec ||
+      (old_st.st_mode & 07777) != (st.st_mode & 07777) ||
+      (geteuid() == 0 && (old_st.st_uid != st.st_uid || old_st.st_gid != st.st_gid)))
+    return false;
+  if (link(old.c_str(), destination.c_str()) == 0)
+    return true;
+  if (errno != EMLINK)
+    return false;
+
+  /* too many snapshots link it already, share its blocks instead where the */
+  /* filesystem can */
+  int from = open(old.c_str(), O_RDONLY | O_CLOEXEC);
+  if (from == -1)
+    return false;
+  int to = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  bool cloned = to != -1 && ioctl(to, FICLONE, from) == 0;
+  if (cloned) {
+    copy_xattrs(from, to, old.c_str());
+    set_metadata(to, st);
+  }
+  close(from);
+  if (to != -1) {
+    close(to);
+    if (!cloned)
+      unlink(destination.c_str());
+  }
+  return cloned;
+}
+
+bool Snapshot::copy_file(const Walker::Entry &entry, const fs::path &destination) {
+  const struct stat &st = entry.st;
+  int in = openat(entry.dirfd, entry.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (in == -1) {
+    Logger::logf(Logger::WARN, "can't read \"%s\": %s", entry.path.c_str(), strerror(errno));
+    return false;
+  }
+  int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (out == -1) {
+    Logger::logf(Logger::WARN, "can't create \"%s\": %s", destination.c_str(), strerror(errno));
+    close(in);
+    return false;
+  }
+
+  bool ok = true;
+  if (this->sparse && (uint64_t)st.st_blocks * 512 < (uint64_t)st.st_size) {
+    /* only the data, the holes stay holes */
+    off_t offset = 0;
+    while (ok && offset < st.st_size) {
+      off_t data = lseek(in, offset, SEEK_DATA);
+      if (data == -1)
+        break;
+      off_t hole = lseek(in, data, SEEK_HOLE);
+      if (hole == -1)
+        hole = st.st_size;
+      ok = copy_range(in, out, data, std::min(hole, st.st_size) - data, this->bytes_copied);
+      offset = hole;
+    }
+    ok = ok && ftruncate(out, st.st_size) == 0;
+  } else {
+    ok = copy_range(in, out, 0, st.st_size, this->bytes_copied);
+  }
+  if (!ok) {
+    Logger::logf(Logger::WARN, "can't copy \"%s\": %s", entry.path.c_str(), strerror(errno));
+    close(in);
+    close(out);
+    unlink(destination.c_str());
+    return false;
+  }
+  copy_xattrs(in, out, entry.path.c_str());
+  set_metadata(out, st);
+  close(in);
+  close(out);
+  return true;
+}
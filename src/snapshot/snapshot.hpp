@@ -0,0 +1,78 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "walker/walker.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* writes a target's tree as a plain directory, <root>/<date>, hard linking the files */
+/* that didn't change to the previous snapshot like rsync --link-dest, so a restore */
+/* is a cp and a run costs the metadata and the changed files */
+class Snapshot {
+  public:
+  /* `source` is the target's path, as the walker names its entries */
+  Snapshot(const std::filesystem::path &root, const std::string &date,
+           const std::filesystem::path &source, bool sparse);
+
+  /* walks the tree into <root>/<date>.partial and renames it into place when done */
+  bool take(Walker &walker);
+
+  /* bytes of the files in the snapshot, and of those copied rather than linked */
+  uint64_t get_bytes_in();
+  uint64_t get_bytes_copied();
+
+  private:
+  std::filesystem::path root;
+  std::string           date;
+  std::filesystem::path source;
+  bool                  sparse;
+  std::filesystem::path partial;
+  std::filesystem::path previous;
+
+  uint64_t bytes_in = 0;
+  uint64_t bytes_copied = 0;
+  size_t   linked = 0;
+  size_t   copied = 0;
+  size_t   failed = 0;
+
+  /* where the first link to each multiply linked file went */
+  std::map<std::pair<dev_t, ino_t>, std::filesystem::path> links;
+  /* directories get their metadata once their contents are written */
+  std::vector<std::pair<std::filesystem::path, struct stat>> directories;
+
+  std::filesystem::path find_previous();
+  std::filesystem::path relative(const std::string &path);
+  void add(const Walker::Entry &entry);
+  void add_file(const Walker::Entry &entry, const std::filesystem::path &relative,
+                const std::filesystem::path &destination);
+  bool link_previous(const struct stat &st, const std::filesystem::path &relative,
+                     const std::filesystem::path &destination);
+  bool copy_file(const Walker::Entry &entry, const std::filesystem::path &destination);
+};
@@ -0,0 +1,265 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "log/log.h"
+#include "stream/stream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* how far the slowest file may fall behind the fastest before it is demoted */
+static constexpr size_t ring_size = 64 << 20;
+/* how long the ring may sit full because of one file before it is demoted */
+static constexpr auto demote_after = std::chrono::seconds(1);
+/* largest single read or catch-up copy */
+static constexpr size_t chunk_size = 1 << 20;
+
+Fanout::Fanout(int in_fd, std::vector<int> out_fds, std::vector<std::string> names) : in_fd(in_fd) {
+  for (size_t i = 0; i < out_fds.size(); i++) {
+    auto sink = std::make_unique<Sink>();
+    sink->fd = out_fds[i];
+    sink->name = names[i];
+    this->sinks.push_back(std::move(sink));
+  }
+}
+
+Fanout::~Fanout() {
+  this->join();
+}
+
+void Fanout::add_writer(const std::string &name, std::function<bool(const char *, size_t)> write,
+                        std::function<bool()> finish) {
+  auto sink = std::make_unique<Sink>();
+  sink->name = name;
+  sink->write = write;
+  sink->finish = finish;
+  this->sinks.push_back(std::move(sink));
+}
+
+void Fanout::set_drop_behind(bool drop_behind) {
+  this->drop_behind = drop_behind;
+}
+
+void Fanout::start() {
+  /* the threads log as whoever started them */
+  this->log_context = Logger::get_log_context();
+  this->ring.resize(ring_size);
+  for (auto &sink : this->sinks) {
+    if (this->drop_behind && sink->fd != -1)
+      sink->dropper = std::make_unique<DropBehind>(sink->fd);
+    sink->thread = std::thread(&Fanout::run_sink, this, std::ref(*sink));
+  }
+  this->thread = std::thread(&Fanout::run, this);
+}
+
+uint64_t Fanout::join() {
+  if (this->thread.joinable())
+    this->thread.join();
+  for (auto &sink : this->sinks) {
+    if (sink->thread.joinable())
+      sink->thread.join();
+  }
+  /* the first file is only closed now, the others may have been catching up from it */
+  for (auto &sink : this->sinks) {
+    /* a full disk can show up only now, ie on NFS */
+    if (sink->fd != -1 && close(sink->fd) != 0 && !sink->failed) {
+      Logger::logf(Logger::ERROR, "closing \"%s\" failed: %s", sink->name.c_str(), strerror(errno));
+      sink->failed = true;
+    }
+    sink->fd = -1;
+  }
+  return this->head;
+}
+
+bool Fanout::has_failed() {
+  bool failed = this->read_failed;
+  for (auto &sink : this->sinks)
+    failed |= sink->failed;
+  return failed;
+}
+
+void Fanout::run() {
+  Logger::set_log_context(this->log_context.c_str());
+  std::unique_lock<std::mutex> lock(this->mutex);
+  for (;;) {
+    /* the ring can't be refilled past the slowest sink still reading from it, */
+    /* which includes a demoted one until its last write out of the ring returns */
+    Sink *slowest = NULL;
+    for (auto &sink : this->sinks) {
+      if ((!sink->demoted || sink->busy) && !sink->failed && (slowest == NULL || sink->done < slowest->done))
+        slowest = sink.get();
+    }
+    uint64_t tail = slowest != NULL ? slowest->done : this->head;
+    if (this->head - tail == ring_size) {
+      bool moved = this->changed.wait_for(lock, demote_after, [&] { return slowest->done != tail || slowest->failed; });
+      /* only a file can be caught up from */
+      bool can_demote = slowest != this->sinks[0].get() && this->sinks[0]->fd != -1;
+      if (!moved && !slowest->demoted && can_demote) {
+        Logger::logf(Logger::WARN, "\"%s\" fell behind, it will catch up from \"%s\"", slowest->name.c_str(),
+                     this->sinks[0]->name.c_str());
+        slowest->demoted = true;
+        this->changed.notify_all();
+      }
+      continue;
+    }
+
+    size_t offset = this->head % ring_size;
+    size_t length = std::min({ring_size - (size_t)(this->head - tail), ring_size - offset, chunk_size});
+    lock.unlock();
+    ssize_t got = read(this->in_fd, this->ring.data() + offset, length);
+    lock.lock();
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got == -1) {
+      Logger::logf(Logger::ERROR, "reading stream failed: %s", strerror(errno));
+      this->read_failed = true;
+    }
+    if (got <= 0)
+      break;
+    this->head += got;
+    this->changed.notify_all();
+  }
+  this->finished = true;
+  this->changed.notify_all();
+  lock.unlock();
+  close(this->in_fd);
+}
+
+bool Fanout::write_sink(Sink &sink, const char *data, size_t length, uint64_t offset) {
+  if (sink.write)
+    return sink.write(data, length);
+  while (length > 0) {
+    ssize_t written = pwrite(sink.fd, data, length, offset);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written == -1) {
+      Logger::logf(Logger::ERROR, "writing \"%s\" failed: %s", sink.name.c_str(), strerror(errno));
+      return false;
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return true;
+}
+
+void Fanout::run_sink(Sink &sink) {
+  Logger::set_log_context(this->log_context.c_str());
+  std::unique_lock<std::mutex> lock(this->mutex);
+  for (;;) {
+    this->changed.wait(lock, [&] { return sink.demoted || this->head > sink.done || this->finished; });
+    if (sink.demoted)
+      break;
+    if (this->head == sink.done)
+      break; /* finished */
+
+    /* small writes, as the ring stays pinned by a write a demotion interrupts */
+    uint64_t done = sink.done;
+    size_t offset = done % ring_size;
+    size_t length = std::min<uint64_t>({this->head - done, ring_size - offset, chunk_size});
+    sink.busy = true;
+    lock.unlock();
+    bool ok = this->write_sink(sink, this->ring.data() + offset, length, done);
+    lock.lock();
+    sink.busy = false;
+    if (!ok) {
+      sink.failed = true;
+      this->changed.notify_all();
+      break;
+    }
+    sink.done += length;
+    if (sink.dropper)
+      sink.dropper->written(sink.done);
+    this->changed.notify_all();
+  }
+  lock.unlock();
+
+  if (sink.demoted && !sink.failed)
+    this->catch_up(sink);
+
+  if (sink.dropper && !sink.failed)
+    sink.dropper->finish(sink.done);
+  bool finished = !sink.finish || sink.finish();
+  lock.lock();
+  if (!finished)
+    sink.failed = true;
+  sink.complete = true;
+  this->changed.notify_all();
+}
+
+void Fanout::catch_up(Sink &sink) {
+  Sink &first = *this->sinks[0];
+  bool use_copy_file_range = sink.fd != -1;
+  std::vector<char> buffer;
+  std::unique_lock<std::mutex> lock(this->mutex);
+  for (;;) {
+    this->changed.wait(lock, [&] { return first.done > sink.done || first.complete; });
+    /* the first file is written by now, or never will be */
+    if (first.done == sink.done) {
+      if (first.done != this->head) {
+        Logger::logf(Logger::ERROR, "\"%s\" can't catch up, \"%s\" is incomplete", sink.name.c_str(),
+                     first.name.c_str());
+        sink.failed = true;
+      }
+      break;
+    }
+    uint64_t done = sink.done;
+    size_t length = std::min<uint64_t>(first.done - done, chunk_size);
+    lock.unlock();
+
+    ssize_t copied = -1;
+    if (use_copy_file_range) {
+      loff_t in_offset = done, out_offset = done;
+      copied = copy_file_range(first.fd, &in_offset, sink.fd, &out_offset, length, 0);
+      if (copied == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+        /* across filesystems, copy by hand */
+        use_copy_file_range = false;
+        lock.lock();
+        continue;
+      }
+    } else {
+      buffer.resize(chunk_size);
+      copied = pread(first.fd, buffer.data(), length, done);
+      if (copied > 0 && !this->write_sink(sink, buffer.data(), copied, done))
+        copied = -2;
+    }
+
+    lock.lock();
+    if (copied == -1 && errno == EINTR)
+      continue;
+    if (copied <= 0) {
+      if (copied == -1)
+        Logger::logf(Logger::ERROR, "copying \"%s\" to \"%s\" failed: %s", first.name.c_str(), sink.name.c_str(),
+                     strerror(errno));
+      sink.failed = true;
+      break;
+    }
+    sink.done += copied;
+    if (sink.dropper)
+      sink.dropper->written(sink.done);
+  }
+}
@@ -0,0 +1,144 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "stream/stream.hpp"
+#include "log/log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* the output is flushed and dropped from the cache in chunks this big */
+static constexpr uint64_t drop_chunk = 8 << 20;
+/* and preallocated this far ahead, so it isn't fragmented by other writers */
+static constexpr uint64_t preallocate_chunk = 64 << 20;
+
+Pump::Pump(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd), dropper(out_fd) {}
+
+Pump::~Pump() {
+  if (this->thread.joinable())
+    this->thread.join();
+}
+
+void Pump::start() {
+  this->thread = std::thread(&Pump::run, this);
+}
+
+uint64_t Pump::join() {
+  if (this->thread.joinable())
+    this->thread.join();
+  return this->bytes;
+}
+
+uint64_t Pump::get_bytes() { return this->bytes; }
+
+bool Pump::has_failed() { return this->failed; }
+
+void Pump::set_drop_behind(bool drop_behind) {
+  this->drop_behind = drop_behind;
+}
+
+DropBehind::DropBehind(int fd) : fd(fd) {}
+
+void DropBehind::written(uint64_t bytes) {
+  if (this->preallocated != UINT64_MAX && bytes + drop_chunk > this->preallocated) {
+    if (fallocate(this->fd, 0, this->preallocated, preallocate_chunk) == 0)
+      this->preallocated += preallocate_chunk;
+    else
+      this->preallocated = UINT64_MAX; /* not supported here, don't try again */
+  }
+  while (bytes >= this->flushed + drop_chunk) {
+    /* start writing back this chunk, then wait for the one before and drop it, */
+    /* so there is always one chunk being written while the next is filled */
+    sync_file_range(this->fd, this->flushed, drop_chunk, SYNC_FILE_RANGE_WRITE);
+    if (this->flushed >= drop_chunk) {
+      sync_file_range(this->fd, this->flushed - drop_chunk, drop_chunk,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(this->fd, this->flushed - drop_chunk, drop_chunk, POSIX_FADV_DONTNEED);
+    }
+    this->flushed += drop_chunk;
+  }
+}
+
+void DropBehind::finish(uint64_t bytes) {
+  /* give back what was preallocated past the end */
+  if (this->preallocated != UINT64_MAX && this->preallocated > bytes)
+    ftruncate(this->fd, bytes);
+  sync_file_range(this->fd, 0, 0,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise(this->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+void Pump::run() {
+  bool use_splice = true;
+  char buffer[1 << 16];
+
+  for (;;) {
+    ssize_t got;
+    if (use_splice) {
+      got = splice(this->in_fd, NULL, this->out_fd, NULL, 1 << 20, SPLICE_F_MOVE);
+      if (got == -1 && (errno == EINVAL || errno == ENOSYS) && this->bytes == 0) {
+        /* neither end is a pipe, copy by hand instead */
+        use_splice = false;
+        continue;
+      }
+    } else {
+      got = read(this->in_fd, buffer, sizeof(buffer));
+      for (ssize_t written = 0; got > 0 && written < got;) {
+        ssize_t ret = write(this->out_fd, buffer + written, got - written);
+        if (ret == -1 && errno == EINTR)
+          continue;
+        if (ret == -1) {
+          got = -1;
+          break;
+        }
+        written += ret;
+      }
+    }
+
+    if (got == 0)
+      break;
+    if (got == -1) {
+      if (errno == EINTR)
+        continue;
+      /* EPIPE means the reader died, it will report its own error */
+      if (errno != EPIPE)
+        Logger::logf(Logger::ERROR, "copying stream failed: %s", strerror(errno));
+      this->failed = true;
+      break;
+    }
+    this->bytes += got;
+    if (this->drop_behind)
+      this->dropper.written(this->bytes);
+  }
+
+  if (this->drop_behind)
+    this->dropper.finish(this->bytes);
+  close(this->in_fd);
+  /* a full disk can show up only now, ie on NFS */
+  if (close(this->out_fd) != 0 && !this->failed) {
+    Logger::logf(Logger::ERROR, "closing stream output failed: %s", strerror(errno));
+    this->failed = true;
+  }
+}
@@ -0,0 +1,154 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* keeps a file being written out of the page cache: preallocates it ahead of the writes, */
+/* and flushes what was written and drops it from the cache */
+class DropBehind {
+  public:
+  DropBehind(int fd);
+
+  /* call after every write, with how much of the file is written */
+  void written(uint64_t bytes);
+  /* call once the file is complete */
+  void finish(uint64_t bytes);
+
+  private:
+  int      fd;
+  uint64_t preallocated = 0;
+  uint64_t flushed = 0;
+};
+
+/* copies everything from one fd to another on its own thread, counting the bytes on the way */
+/* uses splice() so the data never passes through userspace when one side is a pipe */
+class Pump {
+  public:
+
+  /* takes ownership of both fds, they are closed once `in_fd` reaches EOF */
+  Pump(int in_fd, int out_fd);
+
+  Pump(Pump &) = delete;
+
+  ~Pump();
+
+  /* for when `out_fd` is a regular file: preallocate it ahead of the writes, and flush */
+  /* what was written and drop it from the page cache, so the archive evicts nothing */
+  void     set_drop_behind(bool drop_behind);
+
+  void     start();
+
+  /* returns the number of bytes copied */
+  uint64_t join();
+
+  /* can be read while running */
+  uint64_t get_bytes();
+
+  /* whether copying stopped on an error, valid after join() */
+  bool     has_failed();
+
+  private:
+  void run();
+
+  int                   in_fd;
+  int                   out_fd;
+  std::thread           thread;
+  std::atomic<uint64_t> bytes{0};
+  bool                  failed = false;
+  bool                  drop_behind = false;
+  DropBehind            dropper;
+};
+
+/* copies everything from one fd to several files (or other writers) at once, each written */
+/* by its own thread out of a ring buffer they share, so the stream is only produced once */
+/* the first sets the pace; if it is a file, any other that falls a whole ring behind is */
+/* demoted and catches up from the first file instead of holding everything back */
+class Fanout {
+  public:
+
+  /* takes ownership of all fds, the first out fd must also be open for reading */
+  /* `names` are only used for logging */
+  Fanout(int in_fd, std::vector<int> out_fds, std::vector<std::string> names);
+
+  Fanout(Fanout &) = delete;
+
+  ~Fanout();
+
+  /* adds a sink that isn't a file, `write` is given the stream in order and `finish` */
+  /* is called once it has all of it, both return false on failure */
+  void     add_writer(const std::string &name, std::function<bool(const char *, size_t)> write,
+                      std::function<bool()> finish);
+
+  /* see Pump::set_drop_behind(), for the files */
+  void     set_drop_behind(bool drop_behind);
+
+  void     start();
+
+  /* returns the number of bytes copied, once every file has all of them */
+  uint64_t join();
+
+  /* whether reading the stream or any sink failed, valid after join() */
+  bool     has_failed();
+
+  private:
+  struct Sink {
+    int                         fd = -1;
+    std::string                 name;
+    std::function<bool(const char *, size_t)> write;
+    std::function<bool()>       finish;
+    uint64_t                    done = 0; /* bytes written, guarded by mutex */
+    bool                        demoted = false;
+    bool                        failed = false;
+    bool                        busy = false;     /* writing out of the ring */
+    bool                        complete = false; /* won't write any more */
+    std::thread                 thread;
+    std::unique_ptr<DropBehind> dropper;
+  };
+
+  void run();
+  void run_sink(Sink &sink);
+  void catch_up(Sink &sink);
+  bool write_sink(Sink &sink, const char *data, size_t length, uint64_t offset);
+
+  int                                in_fd;
+  std::string                        log_context;
+  std::vector<std::unique_ptr<Sink>> sinks;
+  std::vector<char>                  ring;
+  uint64_t                           head = 0; /* bytes read into the ring, guarded by mutex */
+  bool                               finished = false;
+  bool                               read_failed = false;
+  bool                               drop_behind = false;
+  std::thread                        thread;
+  std::mutex                         mutex;
+  std::condition_variable            changed;
+};
@@ -1,20 +1,69 @@
-
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
 
 #include "subprocess/subprocess.hpp"
 #include "log/log.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
 Subprocess::Subprocess() {}
 
-Subprocess::Subprocess(Subprocess &&other) {
+Subprocess::Subprocess(Subprocess &&other) noexcept {
+  *this = std::move(other);
+}
+
+Subprocess &Subprocess::operator=(Subprocess &&other) noexcept {
+  if (this->pidfd != -1)
+    close(this->pidfd);
   this->env = std::move(other.env);
   this->command = std::move(other.command);
+  this->redirects = std::move(other.redirects);
   this->executable = std::move(other.executable);
-  this->has_executed = std::move(other.has_executed);
-  this->has_detached = std::move(other.has_detached);
-  this->has_joined = std::move(other.has_joined);
-  this->pid = std::move(other.pid);
-  this->return_code = std::move(other.return_code);
-  this->kill_signal_code = std::move(other.kill_signal_code);
+  this->has_executed = other.has_executed;
+  this->has_detached = other.has_detached;
+  this->has_joined = other.has_joined;
+  this->pid = other.pid;
+  this->pidfd = other.pidfd;
+  this->return_code = other.return_code;
+  this->kill_signal_code = other.kill_signal_code;
+
+  /* the moved from object no longer owns the child */
+  other.has_executed = false;
+  other.pid = -1;
+  other.pidfd = -1;
+  return *this;
 }
 
 Subprocess::~Subprocess() {
@@ -23,4 +72,236 @@ Subprocess::~Subprocess() {
                 "Subprocess object destructed without joining or detaching");
     std::terminate();
   }
+  if (this->pidfd != -1)
+    close(this->pidfd);
+}
+
+bool Subprocess::set_executable(std::filesystem::path executable) {
+  std::filesystem::path resolved = executable;
+  if (executable.string().find('/') == std::string::npos) {
+    const char *path_env = std::getenv("PATH");
+    std::string search = path_env ? path_env : "/usr/local/bin:/usr/bin:/bin";
+    resolved.clear();
+    size_t start = 0;
+    while (start <= search.size()) {
+      size_t end = search.find(':', start);
+      if (end == std::string::npos)
+        end = search.size();
+      std::filesystem::path dir = search.substr(start, end - start);
+      if (dir.empty())
+        dir = ".";
+      std::filesystem::path candidate = dir / executable;
+      if (access(candidate.c_str(), X_OK) == 0 && !std::filesystem::is_directory(candidate)) {
+        resolved = candidate;
+        break;
+      }
+      start = end + 1;
+    }
+    if (resolved.empty())
+      return false;
+  } else if (access(resolved.c_str(), X_OK) != 0 || std::filesystem::is_directory(resolved)) {
+    return false;
+  }
+
+  this->executable = resolved;
+  if (this->command.empty())
+    this->command.push_back(executable.string());
+  else
+    this->command[0] = executable.string();
+  return true;
+}
+
+void Subprocess::add_argument(std::string arg) {
+  if (this->command.empty())
+    this->command.push_back(this->executable.string());
+  this->command.push_back(arg);
+}
+
+void Subprocess::set_environment(std::string name, std::string value) {
+  for (auto &var : this->env) {
+    if (var.first == name) {
+      var.second = value;
+      return;
+    }
+  }
+  this->env.emplace_back(name, value);
+}
+
+void Subprocess::redirect(int parent_fd, int child_fd) {
+  this->redirects.emplace_back(parent_fd, child_fd);
+}
+
+bool Subprocess::run() {
+  if (this->has_executed) {
+    Logger::logf(Logger::ERROR, "\"%s\" ran twice (bug)", this->executable.c_str());
+    return true;
+  }
+  if (this->executable.empty()) {
+    Logger::log(Logger::ERROR, "no executable set (bug)");
+    return true;
+  }
+
+  std::vector<char *> argv;
+  for (std::string &arg : this->command)
+    argv.push_back(arg.data());
+  argv.push_back(NULL);
+
+  /* our environment with the overrides replacing any existing definition */
+  std::vector<std::string> env_strings;
+  for (char **var = environ; *var; var++) {
+    const char *eq = std::strchr(*var, '=');
+    std::string name = eq ? std::string(*var, eq - *var) : std::string(*var);
+    bool overridden = false;
+    for (auto &override : this->env)
+      overridden |= override.first == name;
+    if (!overridden)
+      env_strings.emplace_back(*var);
+  }
+  for (auto &override : this->env)
+    env_strings.push_back(override.first + "=" + override.second);
+  std::vector<char *> envp;
+  for (std::string &var : env_strings)
+    envp.push_back(var.data());
+  envp.push_back(NULL);
+
+  /* move every source fd above every destination fd first so the dup2's can't clobber each other */
+  int highest_child_fd = 2;
+  for (auto &redirect : this->redirects)
+    highest_child_fd = std::max(highest_child_fd, redirect.second);
+  std::vector<int> temporary_fds;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  for (auto &redirect : this->redirects) {
+    int fd = fcntl(redirect.first, F_DUPFD_CLOEXEC, highest_child_fd + 1);
+    if (fd == -1) {
+      Logger::logf(Logger::ERROR, "can't duplicate fd %d for \"%s\": %s", redirect.first, this->executable.c_str(), strerror(errno));
+      for (int tmp : temporary_fds)
+        close(tmp);
+      posix_spawn_file_actions_destroy(&actions);
+      return true;
+    }
+    temporary_fds.push_back(fd);
+    posix_spawn_file_actions_adddup2(&actions, fd, redirect.second);
+  }
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGINT);
+  sigaddset(&defaults, SIGTERM);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  int err = posix_spawn(&this->pid, this->executable.c_str(), &actions, &attr, argv.data(), envp.data());
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  for (int tmp : temporary_fds)
+    close(tmp);
+
+  if (err != 0) {
+    Logger::logf(Logger::ERROR, "posix_spawn() failed for \"%s\": %s", this->executable.c_str(), strerror(err));
+    this->pid = -1;
+    return true;
+  }
+  this->has_executed = true;
+
+  /* the child can't be reaped (and its pid reused) before this, so there is no race */
+  this->pidfd = syscall(SYS_pidfd_open, this->pid, 0);
+  if (this->pidfd != -1)
+    fcntl(this->pidfd, F_SETFD, FD_CLOEXEC);
+  return false;
+}
+
+int Subprocess::get_pidfd() { return this->pidfd; }
+
+pid_t Subprocess::get_pid() { return this->pid; }
+
+void Subprocess::reap(bool block) {
+  if (!this->has_executed || this->has_joined || this->has_detached)
+    return;
+  int wstatus = 0;
+  pid_t ret;
+  do {
+    ret = waitpid(this->pid, &wstatus, block ? 0 : WNOHANG);
+  } while (ret == -1 && errno == EINTR);
+  if (ret == 0)
+    return;
+  this->has_joined = true;
+  if (ret == -1) {
+    this->return_code = -1;
+  } else if (WIFSIGNALED(wstatus)) {
+    this->kill_signal_code = WTERMSIG(wstatus);
+    this->return_code = 128 + this->kill_signal_code;
+  } else {
+    this->return_code = WEXITSTATUS(wstatus);
+  }
+  if (this->pidfd != -1) {
+    close(this->pidfd);
+    this->pidfd = -1;
+  }
+}
+
+bool Subprocess::has_exited() {
+  if (!this->has_executed)
+    return false;
+  this->reap(false);
+  return this->has_joined;
+}
+
+pid_t Subprocess::detach() {
+  this->has_detached = true;
+  if (this->pidfd != -1) {
+    close(this->pidfd);
+    this->pidfd = -1;
+  }
+  return this->pid;
+}
+
+int Subprocess::join() {
+  if (!this->has_executed)
+    return -1;
+  this->reap(true);
+  return this->return_code;
+}
+
+int Subprocess::get_kill_signal() { return this->kill_signal_code; }
+
+void Subprocess::wait_any(const std::vector<Subprocess *> &processes, int fd) {
+  for (;;) {
+    std::vector<struct pollfd> fds;
+    bool can_poll = true;
+    for (Subprocess *process : processes) {
+      if (!process->has_executed || process->has_detached)
+        continue;
+      if (process->has_joined)
+        return;
+      if (process->pidfd == -1)
+        can_poll = false;
+      else
+        fds.push_back({process->pidfd, POLLIN, 0});
+    }
+    if (fds.empty() && can_poll)
+      return;
+    if (fd != -1)
+      fds.push_back({fd, POLLIN, 0});
+
+    /* without pidfds fall back to checking every 50ms */
+    int ret = poll(fds.data(), fds.size(), can_poll ? -1 : 50);
+    if (ret == -1 && errno != EINTR)
+      return;
+    if (fd != -1 && ret > 0 && (fds.back().revents & POLLIN))
+      return;
+
+    for (Subprocess *process : processes) {
+      if (process->has_exited())
+        return;
+    }
+  }
 }
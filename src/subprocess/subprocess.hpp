@@ -1,50 +1,103 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
 
+#pragma once
 
 #include <filesystem>
+#include <string>
 #include <sys/types.h>
+#include <utility>
 #include <vector>
+
+/* a child process started with posix_spawn (no second /bin/sh, no copy of our address space) */
+/* with an explicit argv and environment, and a pidfd for event driven waiting */
 class Subprocess {
 
 public:
   Subprocess();
 
   Subprocess(Subprocess &) = delete;
-  Subprocess(Subprocess &&);
+  Subprocess(Subprocess &&) noexcept;
+  Subprocess &operator=(Subprocess &&) noexcept;
 
   ~Subprocess();
 
   /* returns true if the executable */
   /* 1. exists */
   /* 2. is executable by the current user */
-  /* TODO: implement */
+  /* names without a '/' are looked up in PATH */
+  /* the name is also used as argv[0] */
   bool set_executable(std::filesystem::path executable);
 
-  /* TODO: implement */
   void add_argument(std::string arg);
 
+  /* sets NAME=value in the child's environment, which otherwise is a copy of ours */
+  void set_environment(std::string name, std::string value);
+
+  /* makes `parent_fd` available as `child_fd` in the child (ie `redirect(pipefd[1], 1)` for stdout) */
+  /* the parent's fd is left open, every other fd should be O_CLOEXEC */
+  void redirect(int parent_fd, int child_fd);
+
   /* returns whether or not execution failed */
-  /* TODO: implement */
   bool run();
 
+  /* becomes readable once the child exits, -1 if the kernel has no pidfd_open (before 5.3) */
+  int get_pidfd();
+
+  pid_t get_pid();
+
+  /* does not block, the child is reaped if it has exited */
+  bool has_exited();
+
   /* returns the pid of the process */
-  /* TODO: implement */
+  /* the process is no longer waited for */
   pid_t detach();
 
   /* returns the return code of the process */
-  /* TODO: implement */
+  /* 128 + the signal if it was killed by one, -1 if it never ran */
   int join();
 
+  /* 0 unless the process was killed by a signal */
+  int get_kill_signal();
+
+  /* blocks until at least one of `processes` has exited, or `fd` (if not -1) is readable */
+  static void wait_any(const std::vector<Subprocess *> &processes, int fd = -1);
+
 private:
-  std::vector<char *> env;
-  std::vector<char *> command;
+  std::vector<std::pair<std::string, std::string>> env;
+  std::vector<std::string> command;
+  std::vector<std::pair<int, int>> redirects;
   std::filesystem::path executable;
 
-  bool has_executed;
-  bool has_detached;
-  bool has_joined;
+  bool has_executed = false;
+  bool has_detached = false;
+  bool has_joined = false;
+
+  int return_code = -1;
+  int kill_signal_code = 0;
 
-  int return_code;
-  int kill_signal_code;
+  pid_t pid = -1;
+  int pidfd = -1;
 
-  pid_t pid;
+  void reap(bool block);
 };
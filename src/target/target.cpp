@@ -22,27 +22,30 @@
  */
 
 #include "target/target.hpp"
+#include "compress/compress.hpp"
+#include "dictionary/dictionary.hpp"
+#include "jobserver/jobserver.hpp"
 #include "log/log.h"
 #include "parser/parser.hpp"
 #include "utils.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <csignal>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <exception>
+#include <fcntl.h>
 #include <filesystem>
 #include <iostream>
+#include <map>
 #include <string>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <thread>
 #include <unistd.h>
 #include <vector>
 
-using namespace std::chrono_literals;
-
 namespace fs = std::filesystem;
 
 std::string Target::global_pw{""};
@@ -55,8 +58,39 @@ inline std::string toLower(std::string str) {
   return str;
 }
 
+/* a byte count with an optional K, M, G or T suffix (powers of 1024) */
+static bool parse_size(const std::string &str, uint64_t &size) {
+  size_t end;
+  try {
+    size = std::stoull(str, &end);
+  } catch (const std::exception &e) {
+    return false;
+  }
+  std::string suffix = toLower(str.substr(end));
+  const std::string units = "kmgt";
+  if (suffix.empty())
+    return true;
+  if (suffix.size() != 1 || units.find(suffix[0]) == std::string::npos)
+    return false;
+  size <<= 10 * (units.find(suffix[0]) + 1);
+  return true;
+}
+
+/* what an unnamed hook's durations are recorded under */
+static std::string hook_hash(const std::string &command) {
+  char buff[32];
+  std::snprintf(buff, sizeof(buff), "#%016zx", std::hash<std::string>{}(command));
+  return buff;
+}
+
+/* assumed for hooks that never ran, so a chain of them still counts for its length */
+static constexpr double unknown_hook_duration = 1.0;
+
 Target::Target(INI_Parser::INI_Section target_config) {
   std::vector<std::string> paths = target_config["path"];
+  std::vector<std::string> source_commands = target_config["source_command"];
+  std::vector<std::string> source_extensions =
+      target_config["source_extension"];
   std::vector<std::string> elavateds = target_config["elavated"];
   std::vector<std::string> names = target_config["name"];
   std::vector<std::string> dests = target_config["dest"];
@@ -70,8 +104,37 @@ Target::Target(INI_Parser::INI_Section target_config) {
   std::vector<std::string> elavate_program_arr =
       target_config["elavate_program"];
   std::vector<std::string> tar_flags = target_config["add_tar_flag"];
-
-  if (paths.size() != 1) {
+  std::vector<std::string> dictionaries = target_config["dictionary"];
+  std::vector<std::string> orders = target_config["order"];
+  std::vector<std::string> sparses = target_config["sparse"];
+  std::vector<std::string> cache_hygienes = target_config["cache_hygiene"];
+  std::vector<std::string> dest_commands = target_config["dest_command"];
+  std::vector<std::string> dest_command_part_sizes =
+      target_config["dest_command_part_size"];
+  std::vector<std::string> dest_command_parallels =
+      target_config["dest_command_parallel"];
+  std::vector<std::string> shards_arr = target_config["shards"];
+  std::vector<std::string> ignore_files_arr = target_config["ignore_files"];
+  std::vector<std::string> exclude_caches_arr = target_config["exclude_caches"];
+  std::vector<std::string> cache_patterns = target_config["cache_pattern"];
+  std::vector<std::string> delta_min_sizes = target_config["delta_min_size"];
+  std::vector<std::string> outputs = target_config["output"];
+  std::vector<std::string> recompress_levels = target_config["recompress_level"];
+  std::vector<std::string> recompress_afters = target_config["recompress_after"];
+
+  if (source_commands.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "source_command may only be defined once but defined %d times",
+                 source_commands.size());
+    std::exit(1);
+  } else if (source_commands.size() == 1) {
+    this->source_command = source_commands[0];
+    if (!paths.empty()) {
+      Logger::log(Logger::ERROR,
+                  "path and source_command can't both be defined");
+      std::exit(1);
+    }
+  } else if (paths.size() != 1) {
     Logger::logf(Logger::ERROR,
                  "path may only be defined once but defined %d times",
                  paths.size());
@@ -80,6 +143,22 @@ Target::Target(INI_Parser::INI_Section target_config) {
     this->path = resolve_path_with_environment(paths[0]);
   }
 
+  if (source_extensions.size() > 1) {
+    Logger::logf(
+        Logger::ERROR,
+        "source_extension may only be defined once but defined %d times",
+        source_extensions.size());
+    std::exit(1);
+  } else if (source_extensions.size() == 1) {
+    if (this->source_command.empty()) {
+      Logger::log(Logger::ERROR, "source_extension requires source_command");
+      std::exit(1);
+    }
+    this->source_extension = source_extensions[0];
+  } else {
+    this->source_extension = "dump";
+  }
+
   if (elavateds.size() > 1) {
     Logger::logf(Logger::ERROR,
                  "elavated may only be defined once but defined %d times",
@@ -109,16 +188,30 @@ Target::Target(INI_Parser::INI_Section target_config) {
     this->name = names[0];
   }
 
+  this->dest_commands = dest_commands;
+  /* with only dest_commands the archive isn't kept locally, destdir still */
+  /* holds the target's dictionaries */
+  if (!dest_commands.empty() && dests.empty() && options.destdir == "")
+    this->local_archive = false;
+
   if (options.destdir != "") {
     this->destdir = options.destdir;
   } else {
-    if (dests.size() > 1) {
-      Logger::logf(Logger::ERROR,
-                   "dest may only be defined once but defined %d times",
-                   dests.size());
-      std::exit(1);
-    } else if (dests.size() == 1) {
+    if (dests.size() >= 1) {
+      /* the first dest is where dictionaries and the like are kept */
       this->destdir = resolve_path_with_environment(dests[0]);
+      for (size_t i = 1; i < dests.size(); i++) {
+        fs::path mirror = resolve_path_with_environment(dests[i]);
+        if (mirror == this->destdir ||
+            std::find(this->mirror_destdirs.begin(),
+                      this->mirror_destdirs.end(),
+                      mirror) != this->mirror_destdirs.end()) {
+          Logger::logf(Logger::ERROR, "dest \"%s\" defined more than once",
+                       mirror.c_str());
+          std::exit(1);
+        }
+        this->mirror_destdirs.push_back(mirror);
+      }
     } else {
       if (parsed_config[0]["default_dest"].size() == 1)
         this->destdir =
@@ -145,6 +238,7 @@ Target::Target(INI_Parser::INI_Section target_config) {
     this->compress_program = compress_programs[0];
   } else {
     this->compress_program = "zstd --adapt -T0";
+    this->default_compress_program = true;
     if (options.verbosity > 0) {
       this->compress_program += " -v";
     }
@@ -204,30 +298,368 @@ Target::Target(INI_Parser::INI_Section target_config) {
     this->elavate_program = "su";
   }
 
+  if (dictionaries.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "dictionary may only be defined once but defined %d times",
+                 dictionaries.size());
+    std::exit(1);
+  } else if (dictionaries.size() == 1) {
+    if (toLower(dictionaries[0]) == "true")
+      this->dictionary = true;
+    else if (toLower(dictionaries[0]) == "false")
+      this->dictionary = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for dictionary, must be bool",
+                   dictionaries[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->dictionary = false;
+  }
+  if (this->dictionary &&
+      Compressor(this->compress_program).get_family() != Compressor::ZSTD) {
+    Logger::log(Logger::ERROR, "dictionary requires compress_program to be zstd");
+    std::exit(1);
+  }
+  /* the dictionary is made of the files' contents and is kept unencrypted beside the archives */
+  if (this->dictionary && this->encrypt) {
+    Logger::log(Logger::ERROR, "dictionary can't be used with encrypt, it would leak the files it was trained on");
+    std::exit(1);
+  }
+
+  if (orders.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "order may only be defined once but defined %d times",
+                 orders.size());
+    std::exit(1);
+  } else if (orders.size() == 1) {
+    if (!MemberList::parse_order(toLower(orders[0]), this->order)) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for order, must be none, type, inode or extent",
+                   orders[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->order = MemberList::NONE;
+  }
+
+  if (sparses.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "sparse may only be defined once but defined %d times",
+                 sparses.size());
+    std::exit(1);
+  } else if (sparses.size() == 1) {
+    if (toLower(sparses[0]) == "true")
+      this->sparse = true;
+    else if (toLower(sparses[0]) == "false")
+      this->sparse = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for sparse, must be bool",
+                   sparses[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->sparse = true;
+  }
+
+  if (cache_hygienes.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "cache_hygiene may only be defined once but defined %d times",
+                 cache_hygienes.size());
+    std::exit(1);
+  } else if (cache_hygienes.size() == 1) {
+    if (toLower(cache_hygienes[0]) == "true")
+      this->cache_hygiene = true;
+    else if (toLower(cache_hygienes[0]) == "false")
+      this->cache_hygiene = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for cache_hygiene, must be bool",
+                   cache_hygienes[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->cache_hygiene = false;
+  }
+
+  if (ignore_files_arr.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "ignore_files may only be defined once but defined %d times",
+                 ignore_files_arr.size());
+    std::exit(1);
+  } else if (ignore_files_arr.size() == 1) {
+    if (toLower(ignore_files_arr[0]) == "true")
+      this->ignore_files = true;
+    else if (toLower(ignore_files_arr[0]) == "false")
+      this->ignore_files = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for ignore_files, must be bool",
+                   ignore_files_arr[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->ignore_files = false;
+  }
+
+  if (exclude_caches_arr.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "exclude_caches may only be defined once but defined %d times",
+                 exclude_caches_arr.size());
+    std::exit(1);
+  } else if (exclude_caches_arr.size() == 1) {
+    if (toLower(exclude_caches_arr[0]) == "true")
+      this->exclude_caches = true;
+    else if (toLower(exclude_caches_arr[0]) == "false")
+      this->exclude_caches = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for exclude_caches, must be bool",
+                   exclude_caches_arr[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->exclude_caches = false;
+  }
+
+  for (size_t i = 0; i < cache_patterns.size(); i++) {
+    this->cache_patterns.emplace_back(resolve_path_with_environment(cache_patterns[i]));
+  }
+
+  if (delta_min_sizes.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "delta_min_size may only be defined once but defined %d times",
+                 delta_min_sizes.size());
+    std::exit(1);
+  } else if (delta_min_sizes.size() == 1) {
+    if (!parse_size(delta_min_sizes[0], this->delta_min_size)) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for delta_min_size, must be a size "
+                   "(ie 1G)",
+                   delta_min_sizes[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->delta_min_size = 0;
+  }
+
+  if (shards_arr.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "shards may only be defined once but defined %d times",
+                 shards_arr.size());
+    std::exit(1);
+  } else if (shards_arr.size() == 1) {
+    try {
+      int shards = std::stoi(shards_arr[0]);
+      if (shards < 1)
+        throw std::out_of_range("shards");
+      this->shards = shards;
+    } catch (const std::exception &e) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for shards, must be a positive number",
+                   shards_arr[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->shards = 1;
+  }
+
+  if (recompress_levels.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "recompress_level may only be defined once but defined %d times",
+                 recompress_levels.size());
+    std::exit(1);
+  } else if (recompress_levels.size() == 1) {
+    try {
+      int level = std::stoi(recompress_levels[0]);
+      if (level < 1)
+        throw std::out_of_range("recompress_level");
+      this->recompress_level = level;
+    } catch (const std::exception &e) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for recompress_level, must be a positive number",
+                   recompress_levels[0].c_str());
+      std::exit(1);
+    }
+    if (Compressor(this->compress_program).get_family() == Compressor::UNKNOWN) {
+      Logger::log(Logger::ERROR, "recompress_level requires a compress_program backman "
+                                 "knows the levels of (zstd, xz, gzip, pigz, bzip2 or lz4)");
+      std::exit(1);
+    }
+    /* which dictionary an archive was made with isn't recorded */
+    if (this->dictionary) {
+      Logger::log(Logger::ERROR, "recompress_level can't be used with dictionary");
+      std::exit(1);
+    }
+  } else {
+    this->recompress_level = 0;
+  }
+
+  if (recompress_afters.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "recompress_after may only be defined once but defined %d times",
+                 recompress_afters.size());
+    std::exit(1);
+  } else if (recompress_afters.size() == 1) {
+    try {
+      int days = std::stoi(recompress_afters[0]);
+      if (days < 0)
+        throw std::out_of_range("recompress_after");
+      this->recompress_after = days;
+    } catch (const std::exception &e) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for recompress_after, must be a number of days",
+                   recompress_afters[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->recompress_after = 7;
+  }
+
+  /* these need a tree to walk */
+  if (!this->source_command.empty() && this->shards > 1) {
+    Logger::log(Logger::ERROR, "shards requires path, not source_command");
+    std::exit(1);
+  }
+  if (!this->source_command.empty() && this->dictionary) {
+    Logger::log(Logger::ERROR, "dictionary requires path, not source_command");
+    std::exit(1);
+  }
+  if (!this->source_command.empty() && this->order != MemberList::NONE) {
+    Logger::log(Logger::ERROR, "order requires path, not source_command");
+    std::exit(1);
+  }
+  if (!this->source_command.empty() && this->delta_min_size > 0) {
+    Logger::log(Logger::ERROR, "delta_min_size requires path, not source_command");
+    std::exit(1);
+  }
+  if (outputs.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "output may only be defined once but defined %d times",
+                 outputs.size());
+    std::exit(1);
+  } else if (outputs.size() == 1) {
+    if (toLower(outputs[0]) == "snapshot")
+      this->snapshot = true;
+    else if (toLower(outputs[0]) == "archive")
+      this->snapshot = false;
+    else {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for output, must be archive or snapshot",
+                   outputs[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->snapshot = false;
+  }
+
+  /* a snapshot is a plain tree in destdir, there's no stream to compress, */
+  /* encrypt or hand on */
+  if (this->snapshot) {
+    if (!this->source_command.empty()) {
+      Logger::log(Logger::ERROR, "output = snapshot requires path, not source_command");
+      std::exit(1);
+    }
+    if (this->encrypt) {
+      Logger::log(Logger::ERROR, "output = snapshot can't be encrypted");
+      std::exit(1);
+    }
+    if (!this->mirror_destdirs.empty() || !this->dest_commands.empty()) {
+      Logger::log(Logger::ERROR, "output = snapshot takes a single dest and no dest_command");
+      std::exit(1);
+    }
+    if (this->dictionary || this->order != MemberList::NONE ||
+        this->shards > 1 || this->delta_min_size > 0)
+      Logger::log(Logger::WARN, "dictionary, order, shards and delta_min_size "
+                                "are ignored for snapshots");
+  }
+
+  if (!this->source_command.empty() && this->prunes()) {
+    Logger::log(Logger::ERROR, "ignore_files, exclude_caches and cache_pattern "
+                               "require path, not source_command");
+    std::exit(1);
+  }
+
+  if (dest_command_part_sizes.size() > 1) {
+    Logger::logf(
+        Logger::ERROR,
+        "dest_command_part_size may only be defined once but defined %d times",
+        dest_command_part_sizes.size());
+    std::exit(1);
+  } else if (dest_command_part_sizes.size() == 1) {
+    if (!parse_size(dest_command_part_sizes[0],
+                    this->dest_command_part_size)) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for dest_command_part_size, must "
+                   "be a size (ie 512M)",
+                   dest_command_part_sizes[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->dest_command_part_size = 0;
+  }
+
+  if (dest_command_parallels.size() > 1) {
+    Logger::logf(
+        Logger::ERROR,
+        "dest_command_parallel may only be defined once but defined %d times",
+        dest_command_parallels.size());
+    std::exit(1);
+  } else if (dest_command_parallels.size() == 1) {
+    try {
+      int parallel = std::stoi(dest_command_parallels[0]);
+      if (parallel < 1)
+        throw std::out_of_range("dest_command_parallel");
+      this->dest_command_parallel = parallel;
+    } catch (const std::exception &e) {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for dest_command_parallel, must be "
+                   "a positive number",
+                   dest_command_parallels[0].c_str());
+      std::exit(1);
+    }
+  } else {
+    this->dest_command_parallel = 1;
+  }
+  if (this->dest_command_parallel > 1 && this->dest_command_part_size == 0) {
+    Logger::log(Logger::ERROR,
+                "dest_command_parallel requires dest_command_part_size");
+    std::exit(1);
+  }
+
   for (size_t i = 0; i < excludes_arr.size(); i++) {
-    this->excludes.emplace_back(excludes_arr[i]);
+    this->excludes.emplace_back(resolve_path_with_environment(excludes_arr[i]));
+  }
+  for (const fs::path &exclude : this->excludes) {
+    this->exclude_matcher.add(exclude.string());
   }
 
   for (size_t i = 0; i < tar_flags.size(); i++) {
     this->tar_flags.push_back(tar_flags[i]);
   }
 
-  this->destfile = this->destdir / this->get_file_name();
+  if (this->snapshot)
+    this->destfile = this->destdir / this->name / this->get_date();
+  else
+    this->destfile = this->destdir / this->get_file_name();
+  this->deltafile = this->destdir / this->get_file_name(-1, ".delta");
+
+  this->hook_environment = {
+      {"BACKMAN_TARGET_DESTFILE", this->destfile.generic_string()},
+      {"BACKMAN_TARGET_NAME", this->name},
+      {"BACKMAN_TARGET_DESTDIR", this->destdir.generic_string()},
+  };
 
   for (size_t i = 0; i < before_hooks_arr.size(); i++) {
-    this->before_hooks.emplace_back(
-        "BACKMAN_TARGET_DESTFILE=\"" + this->destfile.generic_string() +
-        "\" BACKMAN_TARGET_NAME=\"" + this->name +
-        "\" BACKMAN_TARGET_DESTDIR=\"" + this->destdir.generic_string() + "\"" +
-        before_hooks_arr[i]);
+    this->before_hooks.emplace_back(before_hooks_arr[i], this->hook_environment);
+    this->before_hooks.back().key = "before:" + hook_hash(before_hooks_arr[i]);
   }
 
   for (size_t i = 0; i < end_hooks_arr.size(); i++) {
-    this->end_hooks.emplace_back(
-        "BACKMAN_TARGET_DESTFILE=\"" + this->destfile.generic_string() +
-        "\" BACKMAN_TARGET_NAME=\"" + this->name +
-        "\" BACKMAN_TARGET_DESTDIR=\"" + this->destdir.generic_string() + "\"" +
-        end_hooks_arr[i]);
+    this->end_hooks.emplace_back(end_hooks_arr[i], this->hook_environment);
+    this->end_hooks.back().key = "end:" + hook_hash(end_hooks_arr[i]);
   }
 
 #ifndef NDEBUG
@@ -267,22 +699,221 @@ Target::Target(INI_Parser::INI_Section target_config) {
 #endif
 }
 
-std::string Target::get_file_name() {
+void Target::set_claims(std::shared_ptr<InodeClaims> claims) {
+  /* a command's output has no inodes to share */
+  if (!this->source_command.empty())
+    return;
+  this->claims = claims;
+  this->claims_owner = claims->add_owner(this->name);
+}
+
+void Target::set_cpu_budget(std::shared_ptr<CpuBudget> budget) {
+  this->cpu_budget = budget;
+}
+
+size_t Target::acquire_cpu_share(size_t streams) {
+  if (!this->cpu_budget)
+    return streams;
+  this->cpu_share = this->cpu_budget->acquire();
+  /* a stream needs a thread for its compressor and one for gpg */
+  size_t fit = std::max(this->cpu_share / (this->encrypt ? 2 : 1), 1);
+  return std::min(streams, fit);
+}
+
+void Target::apply_cpu_share(Compressor &compress, size_t streams) {
+  if (!this->cpu_budget)
+    return;
+  if (streams * (this->encrypt ? 2 : 1) > (size_t)this->cpu_share)
+    Logger::logf(Logger::WARN, "%zu streams need more than the cpu budget's %d threads for this target",
+                 streams, this->cpu_share);
+
+  /* gpg takes one of each stream's threads, it only ever uses one */
+  int threads = std::max(this->cpu_share / (int)std::max<size_t>(streams, 1) - (this->encrypt ? 1 : 0), 1);
+  /* a compress_program (or calibration) asking for fewer gets fewer */
+  int asked = compress.get_threads();
+  if (asked > 0)
+    threads = std::min(threads, asked);
+  if (compress.set_threads(threads))
+    Logger::logf(Logger::DEBUG, "%d of the cpu budget's threads, %d per compressor", this->cpu_share, threads);
+  else if (compress.get_family() == Compressor::UNKNOWN)
+    Logger::log(Logger::DEBUG, "can't set the threads of compress_program, it may use more than its share of the cpu budget");
+}
+
+bool Target::prunes() {
+  return this->ignore_files || this->exclude_caches ||
+         !this->cache_patterns.empty();
+}
+
+Walker Target::make_walker() {
+  Walker walker{this->path, this->one_file_system};
+  if (!this->exclude_matcher.empty()) {
+    /* excluded directories are pruned before they are stat'ed or opened */
+    walker.set_path_filter([this](const std::string &path) {
+      return !this->exclude_matcher.matches(path);
+    });
+  }
+  if (this->prunes()) {
+    this->ignore_rules = std::make_unique<IgnoreRules>(
+        this->ignore_files, this->exclude_caches, this->cache_patterns);
+    this->ignore_rules->attach(walker);
+  }
+  return walker;
+}
+
+std::string Target::get_date() {
   time_t t = time(NULL);
   struct tm tm = *localtime(&t);
   char buff[128];
   strftime(buff, sizeof(buff), "%Y-%m-%d", &tm);
-  std::string ext = ".tar";
+  return buff;
+}
+
+std::string Target::get_file_name(int shard, const std::string &extension) {
+  std::string ext = this->source_command.empty()
+                        ? std::string(".tar")
+                        : "." + this->source_extension;
+  if (!extension.empty()) {
+    ext = extension;
+  }
+  if (shard >= 0) {
+    ext = ".shard" + std::to_string(shard) + ext;
+  }
   // ext += this->compress_program;
   if (this->encrypt) {
     ext += ".gpg";
   }
-  std::string name = this->name + "_" + buff + ext;
+  std::string name = this->name + "_" + this->get_date() + ext;
   // char *file_name = Logger::safe_format("%s_%s.tar.%s", this->name.c_str(),
   // buff, ext.c_str()); std::string file_name_str(file_name); free(file_name);
   return name;
 }
 
+void Target::run_snapshot() {
+  /* the walker reads the tree as backman, there's no tar to elavate */
+  if (this->elavated) {
+    Logger::log(Logger::ERROR, "output = snapshot can't be used for elavated targets");
+    std::exit(1);
+  }
+
+  try {
+    fs::create_directories(this->destdir / this->name);
+  } catch (const std::exception &e) {
+    Logger::logf(Logger::ERROR,
+                 "error creating destination directory (no permission?)\"%s\"",
+                 e.what());
+    std::exit(1);
+  }
+
+  Snapshot snapshot{this->destdir / this->name, this->get_date(), this->path,
+                    this->sparse};
+  Walker walker = this->make_walker();
+  if (!snapshot.take(walker))
+    Logger::logf(Logger::ERROR, "snapshot \"%s\" is incomplete",
+                 this->destfile.c_str());
+  this->bytes_in = snapshot.get_bytes_in();
+  this->bytes_out = snapshot.get_bytes_copied();
+}
+
+/* the member list is handed to tar on this fd */
+static constexpr int tar_members_fd = 3;
+/* the excludes are handed to tar on this fd when it walks the tree itself */
+static constexpr int tar_excludes_fd = 4;
+/* the passphrase is handed to gpg on this fd */
+static constexpr int gpg_passphrase_fd = 3;
+
+Subprocess Target::make_tar(bool listed, int list_fd) {
+  Subprocess tar;
+  if (this->elavated) {
+    if (!tar.set_executable(this->elavate_program)) {
+      Logger::logf(Logger::ERROR, "elavate_program \"%s\" not found",
+                   this->elavate_program.c_str());
+      std::exit(1);
+    }
+    tar.add_argument("--");
+    tar.add_argument("tar");
+  } else if (!tar.set_executable("tar")) {
+    Logger::log(Logger::ERROR, "tar not found");
+    std::exit(1);
+  }
+
+  if (this->one_file_system && !listed) {
+    tar.add_argument("--one-file-system");
+  }
+  tar.add_argument("-cp");
+  tar.add_argument("--xattrs");
+  tar.add_argument("--acls");
+  tar.add_argument("-f");
+  tar.add_argument("-");
+  if (this->sparse) {
+    /* tar only maps files with fewer blocks than their size, so this costs */
+    /* nothing for the rest, and --xattrs already makes the archive pax so */
+    /* the holes are recorded as GNU.sparse 1.0 maps */
+    tar.add_argument("--sparse");
+    tar.add_argument("--hole-detection=seek");
+  }
+
+  if (listed) {
+    /* the walk already applied the excludes and one_file_system */
+    tar.add_argument("--null");
+    tar.add_argument("--verbatim-files-from");
+    tar.add_argument("--no-recursion");
+  } else if (list_fd != -1) {
+    tar.redirect(list_fd, tar_excludes_fd);
+    tar.add_argument("--exclude-from");
+    tar.add_argument("/dev/fd/" + std::to_string(tar_excludes_fd));
+  } else {
+    for (size_t i = 0; i < this->excludes.size(); i++) {
+      tar.add_argument("--exclude");
+      tar.add_argument(excludes[i]);
+    }
+  }
+  if (!listed) {
+    /* tar's nearest equivalents, when backman can't walk the tree for it */
+    /* (tar's ignore files have no negation or anchoring and caches keep their tag) */
+    if (this->ignore_files)
+      tar.add_argument("--exclude-ignore-recursive=.backmanignore");
+    if (this->exclude_caches)
+      tar.add_argument("--exclude-caches");
+    for (const std::string &pattern : this->cache_patterns) {
+      tar.add_argument("--exclude");
+      tar.add_argument(pattern + "/*");
+    }
+  }
+
+  for (std::string arg : this->tar_flags) {
+    tar.add_argument(arg);
+  }
+
+  if (listed) {
+    tar.redirect(list_fd, tar_members_fd);
+    tar.add_argument("-T");
+    tar.add_argument("/dev/fd/" + std::to_string(tar_members_fd));
+  } else {
+    tar.add_argument(this->path);
+  }
+  return tar;
+}
+
+Subprocess Target::make_source() {
+  Subprocess source;
+  if (this->elavated) {
+    if (!source.set_executable(this->elavate_program)) {
+      Logger::logf(Logger::ERROR, "elavate_program \"%s\" not found",
+                   this->elavate_program.c_str());
+      std::exit(1);
+    }
+    source.add_argument("--");
+    source.add_argument("/bin/sh");
+  } else {
+    source.set_executable("/bin/sh");
+  }
+  source.add_argument("-c");
+  source.add_argument(this->source_command);
+  source.set_environment("BACKMAN_TARGET_NAME", this->name);
+  source.set_environment("BACKMAN_TARGET_DESTFILE", this->destfile);
+  return source;
+}
+
 void Target::run_main() {
 
   if (this->encrypt && this->passphrase == "") {
@@ -296,142 +927,799 @@ void Target::run_main() {
                                we set it to false so we don't later */
   }
 
-  std::vector<const char *> tar_command;
-  std::vector<const char *> gpg_command;
+  if (this->snapshot) {
+    this->run_snapshot();
+    return;
+  }
 
-  if (this->elavated) {
-    tar_command.push_back(this->elavate_program.c_str());
-    tar_command.push_back("--");
+  /* backman walks the tree itself to order the members, follow tar through them */
+  /* or shard them, which it can't do when only the elavated tar can read it */
+  bool listed = (this->order != MemberList::NONE || this->cache_hygiene ||
+                 this->shards > 1 || this->prunes() || this->claims ||
+                 this->delta_min_size > 0 || options.catalog) &&
+                this->source_command.empty();
+  if (listed && this->elavated) {
+    if (this->order != MemberList::NONE)
+      Logger::log(Logger::WARN, "order is ignored for elavated targets");
+    if (this->cache_hygiene)
+      Logger::log(Logger::WARN, "cache_hygiene only keeps the archive out of the cache for elavated targets");
+    if (this->shards > 1)
+      Logger::log(Logger::WARN, "shards is ignored for elavated targets");
+    if (this->ignore_files)
+      Logger::log(Logger::WARN, "ignore_files follows tar's rules for elavated targets, not gitignore's");
+    if (this->claims)
+      Logger::log(Logger::WARN, "overlap is ignored for elavated targets");
+    if (this->delta_min_size > 0)
+      Logger::log(Logger::WARN, "delta_min_size is ignored for elavated targets");
+    if (options.catalog)
+      Logger::log(Logger::WARN, "elavated targets aren't cataloged");
+    listed = false;
   }
-  tar_command.push_back("tar");
-  if (this->one_file_system) {
-    tar_command.push_back("--one-file-system");
+
+  try {
+    fs::create_directories(this->destdir);
+    for (const fs::path &mirror : this->mirror_destdirs)
+      fs::create_directories(mirror);
+  } catch (const std::exception &e) {
+    Logger::logf(Logger::ERROR,
+                 "error creating destination directory (no permission?)\"%s\"",
+                 e.what());
+    std::exit(1);
   }
-  tar_command.push_back("-cp");
-  tar_command.push_back("--xattrs");
-  tar_command.push_back("--acls");
-  tar_command.push_back("-I");
 
-  tar_command.push_back(this->compress_program.c_str());
+  /* one walk feeds both the dictionary and the member list */
+  Compressor compress{this->compress_program};
+  std::unique_ptr<Dictionary> dictionary;
+  std::unique_ptr<MemberList> members;
+  if (this->dictionary)
+    dictionary = std::make_unique<Dictionary>(this->name, this->destdir);
+  if (listed)
+    members = std::make_unique<MemberList>(this->order);
+  if (listed && this->delta_min_size > 0)
+    this->delta = std::make_unique<DeltaWriter>(
+        this->destdir / (this->name + ".signatures"),
+        this->deltafile.filename().string());
+  if (dictionary || members) {
+    Walker walker = this->make_walker();
+    /* files that an other target of this run has claimed, by that target */
+    std::map<unsigned, std::pair<size_t, uint64_t>> overlaps;
+    walker.walk([&](const Walker::Entry &entry) {
+      if (this->claims && !S_ISDIR(entry.st.st_mode)) {
+        unsigned owner = this->claims->claim(entry.st.st_dev, entry.st.st_ino,
+                                             this->claims_owner);
+        if (owner != this->claims_owner) {
+          overlaps[owner].first++;
+          overlaps[owner].second += entry.st.st_size;
+          Logger::logf(Logger::DEBUG, "\"%s\" is also archived by \"%s\"",
+                       entry.path.c_str(),
+                       this->claims->get_owner_name(owner).c_str());
+          if (this->claims->get_mode() == InodeClaims::SKIP)
+            return;
+        }
+      }
+      Catalog::Member member = {entry.path, entry.st.st_mtim.tv_sec,
+                                (uint64_t)entry.st.st_size, entry.st.st_mode};
+      if (this->delta && S_ISREG(entry.st.st_mode) && entry.st.st_nlink == 1 &&
+          (uint64_t)entry.st.st_size >= this->delta_min_size) {
+        this->delta->add(entry);
+        if (options.catalog)
+          this->catalog_delta_members.push_back(std::move(member));
+        return;
+      }
+      if (dictionary)
+        dictionary->add(entry);
+      if (members) {
+        members->add(entry);
+        if (options.catalog)
+          this->catalog_members.push_back(std::move(member));
+      }
+    });
+    for (auto &overlap : overlaps) {
+      Logger::logf(Logger::WARN, "%zu files (%.1f MiB) are also archived by \"%s\"%s",
+                   overlap.second.first, overlap.second.second / 1048576.0,
+                   this->claims->get_owner_name(overlap.first).c_str(),
+                   this->claims->get_mode() == InodeClaims::SKIP
+                       ? ", left out of this archive"
+                       : "");
+    }
+  }
+  if (dictionary) {
+    fs::path dictionary_file = dictionary->prepare();
+    if (!dictionary_file.empty()) {
+      compress.set_dictionary(dictionary_file);
+    }
+  }
 
-  for (size_t i = 0; i < this->excludes.size(); i++) {
-    tar_command.push_back("--exclude");
-    tar_command.push_back(excludes[i].c_str());
+  size_t delta_streams = this->delta && this->delta->size() > 0 ? 1 : 0;
+  unsigned shards = members ? std::max(this->shards, 1u) : 1;
+  size_t fit = this->acquire_cpu_share(shards + delta_streams);
+  /* more shards than the share has threads for would only run over the budget */
+  if (shards > 1 && fit < shards + delta_streams) {
+    shards = std::max<size_t>(fit - std::min(fit, delta_streams), 1);
+    Logger::logf(Logger::INFO, "%u of %u shards fit the cpu budget's %d threads for this target",
+                 shards, this->shards, this->cpu_share);
+  }
+  this->apply_cpu_share(compress, shards + delta_streams);
+
+  if (!members) {
+    /* thousands of --exclude arguments would run into ARG_MAX, but */
+    /* elavate_program may close the fds it doesn't know about */
+    int excludes_fd = -1;
+    if (this->source_command.empty() && !this->elavated &&
+        !this->exclude_matcher.empty()) {
+      excludes_fd = this->exclude_matcher.to_memfd();
+      if (excludes_fd == -1)
+        std::exit(1);
+    }
+    Subprocess head = this->source_command.empty()
+                          ? this->make_tar(false, excludes_fd)
+                          : this->make_source();
+    this->start_stream(&head, NULL, compress, this->destfile, excludes_fd, NULL);
+    return;
   }
 
-  for (std::string arg : this->tar_flags) {
-    tar_command.push_back(arg.c_str());
+  members->sort();
+  Logger::logf(Logger::DEBUG, "archiving %zu members in order", members->size());
+  std::vector<MemberList> lists;
+  if (shards > 1)
+    lists = members->split(shards, this->sparse);
+  else
+    lists.push_back(std::move(*members));
+  members.reset();
+
+  for (size_t i = 0; i < lists.size(); i++) {
+    int members_fd = lists[i].to_memfd();
+    if (members_fd == -1)
+      std::exit(1);
+    Subprocess tar = this->make_tar(true, members_fd);
+    fs::path destfile = shards > 1 ? this->destdir / this->get_file_name(i)
+                                   : this->destfile;
+    if (shards > 1)
+      Logger::logf(Logger::DEBUG, "shard %zu has %zu members", i, lists[i].size());
+    this->start_stream(&tar, NULL, compress, destfile, members_fd,
+                       this->cache_hygiene ? &lists[i].get_members() : NULL);
   }
 
-  tar_command.push_back(this->path.c_str());
-  if (!encrypt) {
-    tar_command.push_back("-f");
-    tar_command.push_back(this->destfile.c_str());
+  if (this->delta && this->delta->size() > 0) {
+    DeltaWriter *delta = this->delta.get();
+    /* big files' blocks gain nothing from the dictionary, and without it */
+    /* --consolidate and --apply-delta can read the delta with a plain compressor */
+    Compressor delta_compress = compress;
+    delta_compress.set_dictionary("");
+    this->start_stream(NULL, [delta](int fd) { return delta->write(fd); },
+                       delta_compress, this->deltafile, -1, NULL);
+    this->streams.back()->delta = true;
   }
+}
 
-  tar_command.push_back(NULL);
-  /* tar command constructed */
+void Target::start_stream(Subprocess *head, std::function<bool(int)> produce,
+                          Compressor &compress, const fs::path &destfile,
+                          int list_fd,
+                          const std::vector<MemberList::Member> *members) {
+  auto stream = std::make_unique<Stream>();
+  stream->destfile = destfile;
 
-  gpg_command.push_back("gpg");
-  gpg_command.push_back("--batch");
-  gpg_command.push_back("--yes");
-  gpg_command.push_back("--pinentry-mode");
-  gpg_command.push_back("loopback");
-  gpg_command.push_back("--passphrase-fd");
-  size_t gpg_command_pw_fd_index = gpg_command.size();
-  gpg_command.push_back("0");
-  gpg_command.push_back("--symmetric");
-  gpg_command.push_back("--cipher-algo");
-  gpg_command.push_back("AES256");
-  gpg_command.push_back("-o");
-  gpg_command.push_back(this->destfile.c_str());
-  gpg_command.push_back(NULL);
+  Subprocess gpg;
+  if (!gpg.set_executable("gpg") && this->encrypt) {
+    Logger::log(Logger::ERROR, "gpg not found");
+    std::exit(1);
+  }
+  gpg.add_argument("--batch");
+  gpg.add_argument("--yes");
+  gpg.add_argument("--pinentry-mode");
+  gpg.add_argument("loopback");
+  gpg.add_argument("--passphrase-fd");
+  gpg.add_argument(std::to_string(gpg_passphrase_fd));
+  gpg.add_argument("--symmetric");
+  gpg.add_argument("--cipher-algo");
+  gpg.add_argument("AES256");
+  /* the stream is already compressed, compressing it again only costs cpu */
+  gpg.add_argument("--compress-algo");
+  gpg.add_argument("none");
+  /* backman writes the archive itself to keep it out of the cache or to copy */
+  /* it to every dest */
+  bool fanned_out = !this->mirror_destdirs.empty() || !this->dest_commands.empty();
+  bool writes_output = this->cache_hygiene || fanned_out;
+
+  gpg.add_argument("-o");
+  gpg.add_argument(writes_output ? std::string("-") : destfile.string());
+
+  if (members != NULL) {
+    Stream *followed = stream.get();
+    stream->cache_follower = std::make_unique<CacheFollower>(
+        *members, this->sparse,
+        [followed]() { return followed->input_pump->get_bytes(); });
+  }
 
-  try {
-    fs::create_directories(this->destdir);
-  } catch (const std::exception &e) {
-    Logger::logf(Logger::ERROR,
-                 "error creating destination directory (no permission?)\"%s\"",
-                 e.what());
+  Subprocess compressor;
+  if (compress.setup(compressor)) {
+    Logger::logf(Logger::ERROR, "compress_program \"%s\" not found",
+                 this->compress_program.c_str());
     std::exit(1);
   }
 
   /* actually run the programs */
-  if (this->encrypt) {
-    int tar_and_gpg_pipefds[2]; /* [1] is write and [0] is read */
-    pipe(tar_and_gpg_pipefds);
-    pid_t tar_pid = fork();
-    if (tar_pid == 0) {
-      close(tar_and_gpg_pipefds[0]);   /* close read end */
-      dup2(tar_and_gpg_pipefds[1], 1); /* redirect stdout to the pipe */
-      close(tar_and_gpg_pipefds[1]);
-      execvp(tar_command[0], (char *const *)tar_command.data());
-      Logger::log(Logger::ERROR, "execvp() failed");
+  /* tar (or source_command) | pump (counts the uncompressed bytes) | compressor [| gpg] [| pump or fanout] > destfile(s) */
+  auto spawn = [this](Subprocess &process) {
+    if (process.run()) {
+      for (Subprocess &child : this->children) {
+        kill(child.get_pid(), SIGTERM);
+        child.join();
+      }
       std::exit(1);
     }
-    if (tar_pid > 0) {
-      this->children.push_back(tar_pid);
+    this->children.push_back(std::move(process));
+  };
+
+  int tar_pipefds[2]; /* [1] is write and [0] is read */
+  int compress_pipefds[2];
+  if (pipe2(tar_pipefds, O_CLOEXEC) == -1 ||
+      pipe2(compress_pipefds, O_CLOEXEC) == -1) {
+    Logger::log(Logger::ERROR, "pipe() call failed");
+    std::exit(1);
+  }
+  if (head)
+    head->redirect(tar_pipefds[1], 1);
+  compressor.redirect(compress_pipefds[0], 0);
+
+  /* where the last program writes, gpg writes destfile itself unless backman */
+  /* writes it */
+  int dest_fd = -1;
+  int output_fd = -1;
+  int output_pipefds[2];
+  std::vector<int> mirror_fds;
+  std::vector<std::string> mirror_files;
+  if (this->local_archive && (!this->encrypt || writes_output)) {
+    /* the mirrors catch up from destfile if they fall behind, so it's read too */
+    dest_fd = open(destfile.c_str(),
+                   (fanned_out ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dest_fd == -1) {
+      Logger::logf(Logger::ERROR, "can't open \"%s\" for writing",
+                   destfile.c_str());
+      std::exit(1);
     }
-    if (tar_pid == -1) {
-      Logger::log(Logger::ERROR, "fork() call failed");
+    output_fd = dest_fd;
+  }
+  for (const fs::path &mirror : this->mirror_destdirs) {
+    fs::path mirror_file = mirror / destfile.filename();
+    int mirror_fd = open(mirror_file.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mirror_fd == -1) {
+      Logger::logf(Logger::ERROR, "can't open \"%s\" for writing",
+                   mirror_file.c_str());
       std::exit(1);
     }
+    mirror_fds.push_back(mirror_fd);
+    mirror_files.push_back(mirror_file);
+  }
+  if (writes_output) {
+    if (pipe2(output_pipefds, O_CLOEXEC) == -1) {
+      Logger::log(Logger::ERROR, "pipe() call failed");
+      std::exit(1);
+    }
+    output_fd = output_pipefds[1];
+  }
 
+  if (this->encrypt) {
+    int compress_and_gpg_pipefds[2];
     int passphrase_pipefds[2];
-    pipe(passphrase_pipefds);
+    if (pipe2(compress_and_gpg_pipefds, O_CLOEXEC) == -1 ||
+        pipe2(passphrase_pipefds, O_CLOEXEC) == -1) {
+      Logger::log(Logger::ERROR, "pipe() call failed");
+      std::exit(1);
+    }
 
-    pid_t gpg_pid = fork();
+    compressor.redirect(compress_and_gpg_pipefds[1], 1);
+    gpg.redirect(compress_and_gpg_pipefds[0], 0);
+    gpg.redirect(passphrase_pipefds[0], gpg_passphrase_fd);
+    if (output_fd != -1)
+      gpg.redirect(output_fd, 1);
 
-    if (gpg_pid == 0) {
+    if (head) {
+      stream->head_child = this->children.size();
+      spawn(*head);
+    }
+    spawn(compressor);
+    spawn(gpg);
 
-      close(passphrase_pipefds[1]); /* close write end */
-      std::string pw_fd = std::to_string(passphrase_pipefds[0]);
-      gpg_command[gpg_command_pw_fd_index] = pw_fd.c_str();
+    /* only the children may hold these now, or gpg never sees EOF */
+    close(compress_and_gpg_pipefds[0]);
+    close(compress_and_gpg_pipefds[1]);
+    close(passphrase_pipefds[0]);
 
-      close(tar_and_gpg_pipefds[1]);   /* close write end */
-      dup2(tar_and_gpg_pipefds[0], 0); /* redirect pipe to stdin */
-      close(tar_and_gpg_pipefds[0]);
-      execvp(gpg_command[0], (char *const *)gpg_command.data());
-      Logger::log(Logger::ERROR, "execvp() failed");
-      kill(tar_pid, SIGTERM);
-      std::exit(1);
-    }
-    if (gpg_pid > 0) {
-      this->children.push_back(gpg_pid);
+    /* gpg expects to recieve a newline as well, as that is what is supplied
+     * when given normally, as well as when given with [fd]<<< */
+    std::string passphrase = this->passphrase + '\n';
+
+    /* actually ignore the null terminator this time because it isn't
+     * expecting a c string */
+    write(passphrase_pipefds[1], passphrase.c_str(), passphrase.length());
+    close(passphrase_pipefds[1]);
+
+  } else {
+    /* no encryption */
+    compressor.redirect(output_fd, 1);
 
-      /* gpg expects to recieve a newline as well, as that is what is supplied
-       * when given normally, as well as when given with [fd]<<< */
-      this->passphrase += '\n';
+    if (head) {
+      stream->head_child = this->children.size();
+      spawn(*head);
+    }
+    spawn(compressor);
+  }
 
-      /* actually ignore the null terminator this time because it isn't
-       * expecting a c string */
-      write(passphrase_pipefds[1], this->passphrase.c_str(),
-            this->passphrase.length());
-      close(passphrase_pipefds[1]);
+  if (fanned_out) {
+    close(output_pipefds[1]);
+    if (dest_fd != -1) {
+      mirror_fds.insert(mirror_fds.begin(), dest_fd);
+      mirror_files.insert(mirror_files.begin(), destfile);
     }
-    if (gpg_pid == -1) {
-      Logger::log(Logger::ERROR, "fork() failed");
-      std::exit(1);
+    stream->output_fanout = std::make_unique<Fanout>(output_pipefds[0], mirror_fds, mirror_files);
+    std::vector<std::pair<std::string, std::string>> environment = {
+        {"BACKMAN_TARGET_NAME", this->name},
+        {"BACKMAN_ARCHIVE_NAME", destfile.filename().string()},
+    };
+    for (const std::string &command : this->dest_commands) {
+      stream->command_sinks.push_back(std::make_unique<CommandSink>(
+          command, environment, this->dest_command_part_size,
+          this->dest_command_parallel));
+      CommandSink *sink = stream->command_sinks.back().get();
+      stream->output_fanout->add_writer(
+          command,
+          [sink](const char *data, size_t length) {
+            return sink->write(data, length);
+          },
+          [sink]() { return sink->finish(); });
     }
-    close(tar_and_gpg_pipefds[0]);
-    close(tar_and_gpg_pipefds[1]);
+    stream->output_fanout->set_drop_behind(this->cache_hygiene);
+    stream->output_fanout->start();
+  } else if (this->cache_hygiene) {
+    close(output_pipefds[1]);
+    stream->output_pump = std::make_unique<Pump>(output_pipefds[0], dest_fd);
+    stream->output_pump->set_drop_behind(true);
+    stream->output_pump->start();
+  } else if (dest_fd != -1) {
+    close(dest_fd);
+  }
 
+  close(compress_pipefds[0]);
+  if (list_fd != -1)
+    close(list_fd);
+  stream->input_pump = std::make_unique<Pump>(tar_pipefds[0], compress_pipefds[1]);
+  stream->input_pump->start();
+  if (head) {
+    close(tar_pipefds[1]);
   } else {
-    /* no encryption */
-    pid_t tar_pid = fork();
-    if (tar_pid == 0) {
-      execvp(tar_command[0], (char *const *)tar_command.data());
-      Logger::log(Logger::ERROR, "execvp() failed");
-      std::exit(1);
+    Stream *produced = stream.get();
+    int produce_fd = tar_pipefds[1];
+    std::string context = Logger::get_log_context();
+    stream->producer = std::thread([produced, produce, produce_fd, context]() {
+      Logger::set_log_context(context.c_str());
+      produced->produced = produce(produce_fd);
+      close(produce_fd);
+    });
+  }
+  if (stream->cache_follower)
+    stream->cache_follower->start();
+  this->streams.push_back(std::move(stream));
+}
+
+size_t Target::shard_streams() {
+  size_t count = 0;
+  for (const auto &stream : this->streams) {
+    if (!stream->delta)
+      count++;
+  }
+  return count;
+}
+
+void Target::write_manifest() {
+  /* written next to every local copy of the shards */
+  std::vector<fs::path> directories;
+  if (this->local_archive)
+    directories.push_back(this->destdir);
+  directories.insert(directories.end(), this->mirror_destdirs.begin(),
+                     this->mirror_destdirs.end());
+  /* <name>_<date>.shard0.tar[.gpg] becomes <name>_<date>.manifest.ini */
+  std::string manifest_name = this->streams[0]->destfile.filename().string();
+  manifest_name = manifest_name.substr(0, manifest_name.rfind(".shard0")) + ".manifest.ini";
+  for (const fs::path &directory : directories) {
+    fs::path manifest_path = directory / manifest_name;
+    FILE *file = fopen(manifest_path.c_str(), "w");
+    if (file == NULL) {
+      Logger::logf(Logger::WARN, "can't write \"%s\"", manifest_path.c_str());
+      continue;
+    }
+    fprintf(file,
+            "# written by backman, the shards that together are one backup of the target\n"
+            "# restore by extracting every shard into the same directory, shard 0 last so the\n"
+            "# directories' owners, modes and times are the ones kept\n"
+            "[manifest]\n"
+            "target = \"%s\"\n"
+            "shards = %zu\n",
+            this->name.c_str(), this->shard_streams());
+    for (const auto &stream : this->streams) {
+      if (!stream->delta)
+        fprintf(file, "shard = \"%s\"\n", stream->destfile.filename().c_str());
+    }
+    for (const auto &stream : this->streams) {
+      if (stream->delta)
+        fprintf(file, "delta = \"%s\"\n", stream->destfile.filename().c_str());
+    }
+    fclose(file);
+  }
+}
+
+bool Target::replace_archive(const fs::path &archive, Compressor &compress,
+                             std::function<bool(int)> produce,
+                             std::function<bool(const fs::path &)> verify) {
+  /* written beside the archive and renamed over it in every dest, the copies */
+  /* dest_command sent on are left alone */
+  fs::path temporary = archive;
+  temporary += ".partial";
+  std::vector<std::string> dest_commands = std::move(this->dest_commands);
+  this->dest_commands.clear();
+  this->start_stream(NULL, produce, compress, temporary, -1, NULL);
+  bool ok = true;
+  for (Subprocess &child : this->children) {
+    if (child.join() != 0)
+      ok = false;
+  }
+  this->wait_streams();
+  /* a dest that failed on its own (ie filled up) leaves the compressor and */
+  /* gpg exiting 0, so its copy would be renamed over the good archive */
+  ok = ok && this->streams.back()->produced && !this->streams.back()->failed;
+  this->streams.clear();
+  this->children.clear();
+  this->dest_commands = std::move(dest_commands);
+  if (ok && verify)
+    ok = verify(temporary);
+
+  /* all or none of the dests are replaced, so the mirrors keep matching */
+  std::vector<fs::path> dirs = {this->destdir};
+  dirs.insert(dirs.end(), this->mirror_destdirs.begin(), this->mirror_destdirs.end());
+  for (const fs::path &dir : dirs) {
+    fs::path from = dir / temporary.filename();
+    fs::path to = dir / archive.filename();
+    if (!ok) {
+      unlink(from.c_str());
+    } else if (rename(from.c_str(), to.c_str()) == -1) {
+      Logger::logf(Logger::ERROR, "can't replace \"%s\": %s", to.c_str(), strerror(errno));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/* reads until `length` bytes or the end, returns how many were read */
+static size_t read_full(int fd, char *data, size_t length) {
+  size_t got = 0;
+  while (got < length) {
+    ssize_t n = read(fd, data + got, length - got);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  return got;
+}
+
+bool Target::recompress() {
+  if (this->recompress_level == 0) {
+    Logger::log(Logger::INFO, "recompress_level isn't set, nothing to do");
+    return true;
+  }
+  if (this->snapshot || !this->local_archive) {
+    Logger::log(Logger::ERROR, "nothing to recompress, there are no archives in dest");
+    return false;
+  }
+
+  /* the archives already rewritten, so an interrupted pass picks up where it */
+  /* stopped */
+  fs::path checkpoint_path = this->destdir / (this->name + ".recompress.ini");
+  std::vector<std::string> done;
+  if (fs::exists(checkpoint_path)) {
+    try {
+      for (INI_Parser::INI_Section section : INI_Parser::ini_parse(checkpoint_path)) {
+        if (section.get_section_name() != "recompressed")
+          continue;
+        /* archives since deleted drop out */
+        for (const std::string &archive : section["archive"]) {
+          if (fs::exists(this->destdir / archive))
+            done.push_back(archive);
+        }
+      }
+    } catch (std::exception &e) {
+      Logger::logf(Logger::WARN, "\"%s\" is damaged, starting over", checkpoint_path.c_str());
+    }
+  }
+  auto save_checkpoint = [&]() {
+    fs::path temporary = checkpoint_path;
+    temporary += ".tmp";
+    FILE *file = fopen(temporary.c_str(), "w");
+    if (file == NULL) {
+      Logger::logf(Logger::WARN, "can't write \"%s\"", temporary.c_str());
+      return;
     }
-    if (tar_pid > 0) {
-      this->children.push_back(tar_pid);
+    fprintf(file, "# written by backman, the archives --recompress already rewrote\n"
+                  "[recompressed]\n");
+    for (const std::string &archive : done)
+      fprintf(file, "archive = \"%s\"\n", archive.c_str());
+    fclose(file);
+    rename(temporary.c_str(), checkpoint_path.c_str());
+  };
+
+  /* <name>_YYYY-MM-DD.<extension>[.gpg], older than recompress_after days */
+  time_t cutoff_time = time(NULL) - (time_t)this->recompress_after * 24 * 60 * 60;
+  struct tm tm = *localtime(&cutoff_time);
+  char cutoff[128];
+  strftime(cutoff, sizeof(cutoff), "%Y-%m-%d", &tm);
+  std::string prefix = this->name + "_";
+  std::vector<fs::path> archives;
+  std::error_code ec;
+  for (const fs::directory_entry &entry : fs::directory_iterator(this->destdir, ec)) {
+    std::string file_name = entry.path().filename().string();
+    if (file_name.size() <= prefix.size() + 11 || file_name.compare(0, prefix.size(), prefix) != 0 ||
+        file_name[prefix.size() + 10] != '.' || !entry.is_regular_file(ec))
+      continue;
+    std::string date = file_name.substr(prefix.size(), 10);
+    std::string extension = fs::path(file_name).extension().string();
+    if (date > cutoff || extension == ".ini" || extension == ".partial" || extension == ".dict" ||
+        (extension == ".gpg") != this->encrypt ||
+        std::find(done.begin(), done.end(), file_name) != done.end())
+      continue;
+    archives.push_back(entry.path());
+  }
+  /* oldest first */
+  std::sort(archives.begin(), archives.end());
+
+  Compressor compress{this->compress_program};
+  compress.set_level(this->recompress_level);
+  Logger::logf(Logger::DEBUG, "recompressing %zu archives with \"%s\"", archives.size(),
+               compress.get_command().c_str());
+  bool ok = true;
+  uint64_t saved = 0;
+  size_t rewritten = 0;
+  for (const fs::path &archive : archives) {
+    if (options.deadline != 0 && time(NULL) >= options.deadline) {
+      Logger::logf(Logger::INFO, "deadline reached, %zu archives left for the next pass",
+                   archives.size() - (&archive - archives.data()));
+      break;
+    }
+    uint64_t before = fs::file_size(archive, ec);
+
+    /* archive [| gpg -d] | decompressor | the new compressor [| gpg] > archive.partial */
+    std::vector<Subprocess> readers;
+    int input = this->read_archive(archive, readers);
+    if (input == -1) {
+      ok = false;
+      continue;
+    }
+    auto copy = [input](int fd) {
+      std::vector<char> buffer(1 << 20);
+      for (;;) {
+        size_t n = read_full(input, buffer.data(), buffer.size());
+        if (n == 0)
+          return true;
+        size_t written = 0;
+        while (written < n) {
+          ssize_t w = write(fd, buffer.data() + written, n - written);
+          if (w == -1 && errno == EINTR)
+            continue;
+          if (w == -1)
+            return false;
+          written += w;
+        }
+      }
+    };
+    /* both archives must decompress to the same bytes before one replaces the other */
+    bool larger = false;
+    auto verify = [this, &archive, before, &larger](const fs::path &temporary) {
+      /* not worth replacing, and not worth trying again either */
+      std::error_code size_ec;
+      if (fs::file_size(temporary, size_ec) >= before) {
+        larger = true;
+        return false;
+      }
+      std::vector<Subprocess> verifiers;
+      int original = this->read_archive(archive, verifiers);
+      int rewritten = this->read_archive(temporary, verifiers);
+      bool same = original != -1 && rewritten != -1;
+      std::vector<char> a(1 << 20), b(1 << 20);
+      while (same) {
+        size_t n = read_full(original, a.data(), a.size());
+        size_t m = read_full(rewritten, b.data(), b.size());
+        same = n == m && std::memcmp(a.data(), b.data(), n) == 0;
+        if (n == 0)
+          break;
+      }
+      if (original != -1)
+        close(original);
+      if (rewritten != -1)
+        close(rewritten);
+      for (Subprocess &verifier : verifiers) {
+        if (verifier.join() != 0)
+          same = false;
+      }
+      if (!same)
+        Logger::logf(Logger::ERROR, "\"%s\" doesn't match once recompressed, keeping it",
+                     archive.c_str());
+      return same;
+    };
+    bool replaced = this->replace_archive(archive, compress, copy, verify);
+    close(input);
+    /* verify() read the archive again, so how these exited doesn't matter */
+    for (Subprocess &reader : readers)
+      reader.join();
+    if (!replaced && !larger) {
+      ok = false;
+      continue;
     }
-    if (tar_pid == -1) {
-      Logger::log(Logger::ERROR, "fork() call failed");
+    if (larger) {
+      Logger::logf(Logger::DEBUG, "\"%s\" is no smaller recompressed, keeping it", archive.c_str());
+    } else {
+      uint64_t after = fs::file_size(archive, ec);
+      saved += before - after;
+      Logger::logf(Logger::DEBUG, "recompressed \"%s\", %llu to %llu bytes", archive.c_str(),
+                   (unsigned long long)before, (unsigned long long)after);
+      rewritten++;
+    }
+    done.push_back(archive.filename().string());
+    save_checkpoint();
+  }
+  Logger::logf(Logger::INFO, "recompressed %zu archives, %llu bytes saved", rewritten,
+               (unsigned long long)saved);
+  return ok;
+}
+
+int Target::read_archive(const fs::path &archive, std::vector<Subprocess> &readers) {
+  int archive_fd = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+  if (archive_fd == -1) {
+    Logger::logf(Logger::ERROR, "can't open \"%s\": %s", archive.c_str(), strerror(errno));
+    return -1;
+  }
+  Subprocess decompressor;
+  if (Compressor(this->compress_program).setup_decompress(decompressor)) {
+    Logger::logf(Logger::ERROR, "compress_program \"%s\" not found",
+                 this->compress_program.c_str());
+    close(archive_fd);
+    return -1;
+  }
+  int output_pipefds[2];
+  if (pipe2(output_pipefds, O_CLOEXEC) == -1) {
+    Logger::log(Logger::ERROR, "pipe() call failed");
+    close(archive_fd);
+    return -1;
+  }
+  decompressor.redirect(output_pipefds[1], 1);
+
+  /* archive [| gpg] | decompressor | returned fd */
+  bool failed = false;
+  if (this->encrypt) {
+    Subprocess gpg;
+    if (!gpg.set_executable("gpg")) {
+      Logger::log(Logger::ERROR, "gpg not found");
+      std::exit(1);
+    }
+    gpg.add_argument("--batch");
+    gpg.add_argument("--quiet");
+    gpg.add_argument("--pinentry-mode");
+    gpg.add_argument("loopback");
+    gpg.add_argument("--passphrase-fd");
+    gpg.add_argument(std::to_string(gpg_passphrase_fd));
+    gpg.add_argument("--decrypt");
+
+    int gpg_pipefds[2];
+    int passphrase_pipefds[2];
+    if (pipe2(gpg_pipefds, O_CLOEXEC) == -1 ||
+        pipe2(passphrase_pipefds, O_CLOEXEC) == -1) {
+      Logger::log(Logger::ERROR, "pipe() call failed");
       std::exit(1);
     }
+    gpg.redirect(archive_fd, 0);
+    gpg.redirect(gpg_pipefds[1], 1);
+    gpg.redirect(passphrase_pipefds[0], gpg_passphrase_fd);
+    decompressor.redirect(gpg_pipefds[0], 0);
+    failed = gpg.run() || decompressor.run();
+    readers.push_back(std::move(gpg));
+    readers.push_back(std::move(decompressor));
+    close(gpg_pipefds[0]);
+    close(gpg_pipefds[1]);
+    close(passphrase_pipefds[0]);
+
+    std::string passphrase = this->passphrase + '\n';
+    write(passphrase_pipefds[1], passphrase.c_str(), passphrase.length());
+    close(passphrase_pipefds[1]);
+  } else {
+    decompressor.redirect(archive_fd, 0);
+    failed = decompressor.run();
+    readers.push_back(std::move(decompressor));
   }
+  close(archive_fd);
+  close(output_pipefds[1]);
+  if (failed) {
+    close(output_pipefds[0]);
+    return -1;
+  }
+  return output_pipefds[0];
+}
+
+bool Target::consolidate(bool named) {
+  /* run over all targets, only the ones making delta archives are meant */
+  if (!named && (this->delta_min_size == 0 || this->elavated || this->snapshot || !this->local_archive)) {
+    Logger::log(Logger::DEBUG, "no delta archives, skipped");
+    return true;
+  }
+  if (!this->local_archive) {
+    Logger::log(Logger::ERROR, "nothing to consolidate, the archives only went to dest_command");
+    return false;
+  }
+
+  /* name_YYYY-MM-DD.delta[.gpg], the dates sort as they are */
+  std::string prefix = this->name + "_";
+  std::string suffix = this->encrypt ? ".delta.gpg" : ".delta";
+  fs::path newest;
+  std::error_code ec;
+  for (const fs::directory_entry &entry : fs::directory_iterator(this->destdir, ec)) {
+    std::string file_name = entry.path().filename().string();
+    if (file_name.size() == prefix.size() + 10 + suffix.size() &&
+        file_name.compare(0, prefix.size(), prefix) == 0 &&
+        file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) == 0 &&
+        (newest.empty() || file_name > newest.filename().string()))
+      newest = entry.path();
+  }
+  if (newest.empty()) {
+    if (!named) {
+      Logger::logf(Logger::INFO, "no delta archives in \"%s\" yet, skipped", this->destdir.c_str());
+      return true;
+    }
+    Logger::logf(Logger::ERROR, "no delta archives in \"%s\"", this->destdir.c_str());
+    return false;
+  }
+
+  /* back from the newest delta to the full one, by the base each names */
+  DeltaMerger merger{this->destdir};
+  fs::path archive = newest;
+  for (;;) {
+    std::vector<Subprocess> readers;
+    int fd = this->read_archive(archive, readers);
+    bool ok = fd != -1 && merger.add(fd);
+    if (fd != -1)
+      close(fd);
+    for (Subprocess &reader : readers) {
+      if (reader.join() != 0 && ok) {
+        Logger::logf(Logger::ERROR, "can't read \"%s\"%s", archive.c_str(),
+                     this->encrypt ? " (wrong passphrase?)" : "");
+        ok = false;
+      }
+    }
+    if (!ok)
+      return false;
+    if (merger.get_base().empty())
+      break;
+    archive = this->destdir / merger.get_base();
+    if (!fs::exists(archive, ec)) {
+      Logger::logf(Logger::ERROR, "the chain needs \"%s\", which is missing", archive.c_str());
+      return false;
+    }
+  }
+  if (merger.get_count() == 1) {
+    Logger::logf(Logger::INFO, "\"%s\" is already a full delta", newest.c_str());
+    return true;
+  }
+
+  /* the copies dest_command sent on keep their chain */
+  Compressor compress{this->compress_program};
+  bool ok = this->replace_archive(newest, compress,
+                                  [&merger](int fd) { return merger.write(fd); }, nullptr);
+  if (!ok) {
+    Logger::logf(Logger::ERROR, "consolidating \"%s\" failed, the deltas are untouched", newest.c_str());
+    return false;
+  }
+  Logger::logf(Logger::INFO, "consolidated %zu deltas into \"%s\", %llu bytes, the older ones "
+               "are only needed to restore earlier runs",
+               merger.get_count(), newest.c_str(), (unsigned long long)this->bytes_out);
+  return true;
 }
 
 void Target::set_passphrase() {
@@ -472,79 +1760,408 @@ void Target::set_passphrase() {
 bool Target::is_encrypted() { return this->encrypt; }
 
 bool Target::has_exited() {
-  for (pid_t cpid : this->children) {
-    int status = 0;
-    waitpid(cpid, &status, WNOHANG);
-    bool has_exited = WIFEXITED(status) || WIFSIGNALED(status);
-    if (has_exited)
+  for (Subprocess &child : this->children) {
+    if (child.has_exited())
       return true;
   }
   return false;
 }
 
 void Target::wait_main() {
-  for (pid_t cpid : this->children) {
-    int stat = 0;
-    waitpid(cpid, &stat, 0);
+  /* run_main() did all of it */
+  if (this->snapshot)
+    return;
+  /* tar exits with 1 when files changed as it read them, the archive is still whole */
+  std::vector<bool> tars(this->children.size(), false);
+  for (auto &stream : this->streams) {
+    if (stream->head_child >= 0 && this->source_command.empty())
+      tars[stream->head_child] = true;
+  }
+  bool whole = true;
+  for (size_t i = 0; i < this->children.size(); i++) {
+    int code = this->children[i].join();
+    /* tar reports its own errors, a dump command may fail silently */
+    if (i == 0 && !this->source_command.empty() && code != 0) {
+      Logger::logf(Logger::ERROR, "source_command exited with %d", code);
+    }
+    if (code != 0 && !(tars[i] && code == 1))
+      whole = false;
+  }
+  /* the compressors and gpg are gone, the next target to start can have their threads */
+  if (this->cpu_share > 0) {
+    this->cpu_budget->release(this->cpu_share);
+    this->cpu_share = 0;
+  }
+  this->wait_streams();
+  /* sharding is skipped for targets backman can't walk, whatever shards says */
+  bool sharded = this->shard_streams() > 1;
+  if (sharded) {
+    this->write_manifest();
+  }
+  for (auto &stream : this->streams) {
+    if ((stream->delta && !stream->produced) || stream->failed)
+      whole = false;
+  }
+  if (whole && !this->catalog_members.empty()) {
+    /* a sharded run is found by its manifest */
+    fs::path archive = sharded
+                           ? this->destdir / (this->name + "_" + this->get_date() + ".manifest.ini")
+                           : this->destfile;
+    Catalog::add_run(state_directory() / "catalog",
+                     {this->name, archive.string(), (int64_t)time(NULL)},
+                     std::move(this->catalog_members));
+  }
+  /* the delta archive's files are a run of their own, so their versions follow */
+  /* from the target's last delta archive rather than its last tar */
+  if (whole && !this->catalog_delta_members.empty()) {
+    Catalog::add_run(state_directory() / "catalog",
+                     {this->name + ".delta", this->deltafile.string(), (int64_t)time(NULL)},
+                     std::move(this->catalog_delta_members));
+  }
+  this->catalog_members.clear();
+  this->catalog_delta_members.clear();
+  for (auto &stream : this->streams) {
+    if (!stream->delta)
+      continue;
+    /* the next run's delta is against this one only if it was written whole, */
+    /* a partial one would break every delta after it */
+    if (whole) {
+      this->delta->save();
+      continue;
+    }
+    Logger::logf(Logger::ERROR, "the run failed, removing the delta archive \"%s\"", stream->destfile.c_str());
+    std::error_code ec;
+    fs::remove(stream->destfile, ec);
+    for (const fs::path &mirror : this->mirror_destdirs)
+      fs::remove(mirror / stream->destfile.filename(), ec);
+  }
+  this->delta.reset();
+}
+
+void Target::wait_streams() {
+  this->bytes_in = 0;
+  this->bytes_out = 0;
+  for (auto &stream : this->streams) {
+    if (stream->producer.joinable()) {
+      stream->producer.join();
+    }
+    this->bytes_in += stream->input_pump->join();
+    if (stream->output_pump) {
+      stream->output_pump->join();
+      stream->failed |= stream->output_pump->has_failed();
+    }
+    uint64_t streamed = 0;
+    if (stream->output_fanout) {
+      streamed = stream->output_fanout->join();
+      stream->failed |= stream->output_fanout->has_failed();
+    }
+    if (stream->cache_follower) {
+      stream->cache_follower->stop();
+    }
+    if (this->local_archive) {
+      std::error_code ec;
+      uint64_t size = fs::file_size(stream->destfile, ec);
+      this->bytes_out += ec ? 0 : size;
+    } else {
+      this->bytes_out += streamed;
+    }
   }
 }
 
+uint64_t Target::get_bytes_in() { return this->bytes_in; }
+
+uint64_t Target::get_bytes_out() { return this->bytes_out; }
+
+bool Target::lower_compression() {
+  Compressor compress{this->compress_program};
+  if (this->compression_lowered || !compress.set_fastest_level()) {
+    return false;
+  }
+  this->compress_program = compress.get_command();
+  this->compression_lowered = true;
+  return true;
+}
+
+bool Target::is_compression_lowered() { return this->compression_lowered; }
+
 std::string Target::get_name() { return this->name; }
 
 std::filesystem::path Target::get_path() { return this->path; }
 
-bool Target::run_hooks(std::vector<Target::SystemCommand> hooks) {
-  int status = 0;
+std::string Target::get_source_command() { return this->source_command; }
 
-  int num_hooks = hooks.size();
-  int running_children = 0;
-  while (num_hooks > 0) {
+std::filesystem::path Target::get_destdir() { return this->destdir; }
 
-    /* spawn children */
-    if (running_children < options.jobs) {
-      hooks[--num_hooks].run();
-      running_children++;
-    } else {
-      /* stop spawning and start checking for exits */
-      for (int i = hooks.size() - 1; i >= num_hooks; i--) {
-        if (hooks[i].has_exited()) {
-          status |= hooks[i].wait();
-          running_children--;
-        }
+std::string Target::get_compress_program() { return this->compress_program; }
+
+void Target::set_compress_program(const std::string &compress_program) {
+  this->compress_program = compress_program;
+}
+
+bool Target::has_default_compress_program() {
+  return this->default_compress_program;
+}
+
+void Target::add_hook(INI_Parser::INI_Section hook_config) {
+  std::vector<std::string> names = hook_config["name"];
+  std::vector<std::string> commands = hook_config["command"];
+  std::vector<std::string> whens = hook_config["when"];
+  std::vector<std::string> afters = hook_config["after"];
+  std::vector<std::string> exclusives = hook_config["exclusive"];
+
+  if (commands.size() != 1) {
+    Logger::logf(Logger::ERROR,
+                 "command may only be defined once but defined %d times",
+                 commands.size());
+    std::exit(1);
+  }
+  if (names.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "name may only be defined once but defined %d times",
+                 names.size());
+    std::exit(1);
+  }
+  std::vector<SystemCommand> *hooks = &this->before_hooks;
+  std::string phase = "before";
+  if (whens.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "when may only be defined once but defined %d times",
+                 whens.size());
+    std::exit(1);
+  } else if (whens.size() == 1) {
+    if (toLower(whens[0]) == "end") {
+      hooks = &this->end_hooks;
+      phase = "end";
+    } else if (toLower(whens[0]) != "before") {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for when, must be before or end",
+                   whens[0].c_str());
+      std::exit(1);
+    }
+  }
+
+  bool exclusive = false;
+  if (exclusives.size() > 1) {
+    Logger::logf(Logger::ERROR,
+                 "exclusive may only be defined once but defined %d times",
+                 exclusives.size());
+    std::exit(1);
+  } else if (exclusives.size() == 1) {
+    if (toLower(exclusives[0]) == "true")
+      exclusive = true;
+    else if (toLower(exclusives[0]) != "false") {
+      Logger::logf(Logger::ERROR,
+                   "invalid value \"%s\" for exclusive, must be bool",
+                   exclusives[0].c_str());
+      std::exit(1);
+    }
+  }
+
+  hooks->emplace_back(commands[0], this->hook_environment);
+  SystemCommand &hook = hooks->back();
+  hook.name = names.empty() ? "" : names[0];
+  hook.after = afters;
+  hook.exclusive = exclusive;
+  hook.key = phase + ":" + (hook.name.empty() ? hook_hash(commands[0]) : hook.name);
+}
+
+void Target::resolve_hooks() {
+  Target::resolve_hooks(this->before_hooks, "before");
+  Target::resolve_hooks(this->end_hooks, "end");
+}
+
+void Target::resolve_hooks(std::vector<SystemCommand> &hooks, const char *phase) {
+  std::map<std::string, size_t> names;
+  for (size_t i = 0; i < hooks.size(); i++) {
+    if (hooks[i].name.empty())
+      continue;
+    if (!names.emplace(hooks[i].name, i).second) {
+      Logger::logf(Logger::ERROR, "%s hook \"%s\" defined more than once", phase,
+                   hooks[i].name.c_str());
+      std::exit(1);
+    }
+  }
+  for (SystemCommand &hook : hooks) {
+    hook.dependencies.clear();
+    for (const std::string &after : hook.after) {
+      auto found = names.find(after);
+      if (found == names.end()) {
+        Logger::logf(Logger::ERROR, "%s hook \"%s\" is after \"%s\", which isn't a %s hook",
+                     phase, hook.name.empty() ? hook.get_command().c_str() : hook.name.c_str(), after.c_str(), phase);
+        std::exit(1);
       }
-      std::this_thread::sleep_for(50ms);
+      hook.dependencies.push_back(found->second);
     }
   }
+
+  /* every hook must be reachable by peeling off those with nothing left before them */
+  std::vector<size_t> waiting(hooks.size());
+  std::vector<size_t> ready;
   for (size_t i = 0; i < hooks.size(); i++) {
-    status |= hooks[i].wait();
+    waiting[i] = hooks[i].dependencies.size();
+    if (waiting[i] == 0)
+      ready.push_back(i);
+  }
+  size_t peeled = 0;
+  while (!ready.empty()) {
+    size_t done = ready.back();
+    ready.pop_back();
+    peeled++;
+    for (size_t i = 0; i < hooks.size(); i++) {
+      for (size_t dependency : hooks[i].dependencies) {
+        if (dependency == done && --waiting[i] == 0)
+          ready.push_back(i);
+      }
+    }
+  }
+  if (peeled != hooks.size()) {
+    Logger::logf(Logger::ERROR, "the %s hooks' afters form a cycle", phase);
+    std::exit(1);
+  }
+}
+
+bool Target::run_hooks(std::vector<Target::SystemCommand> &hooks,
+                       const std::function<double(const std::string &)> &predict) {
+  bool failed = false;
+  size_t count = hooks.size();
+
+  /* a hook's priority is the longest chain of hooks from it to one nothing comes */
+  /* after, as the phase can't end before that chain does */
+  std::vector<std::vector<size_t>> dependents(count);
+  for (size_t i = 0; i < count; i++) {
+    for (size_t dependency : hooks[i].dependencies)
+      dependents[dependency].push_back(i);
   }
+  std::vector<double> chain(count, -1);
+  std::function<double(size_t)> chain_of = [&](size_t i) {
+    if (chain[i] >= 0)
+      return chain[i];
+    double duration = predict ? predict(hooks[i].key) : -1;
+    double longest = 0;
+    for (size_t dependent : dependents[i])
+      longest = std::max(longest, chain_of(dependent));
+    chain[i] = (duration < 0 ? unknown_hook_duration : duration) + longest;
+    return chain[i];
+  };
+  for (size_t i = 0; i < count; i++)
+    chain_of(i);
+
+  enum State { WAITING, RUNNING, DONE, SKIPPED };
+  std::vector<State> states(count, WAITING);
+  std::vector<Jobserver::Slot> slots(count);
+  std::vector<SystemCommand *> running;
+  this->hook_durations.clear();
+  size_t finished = 0;
+  while (finished < count) {
+
+    /* hooks after one that failed don't run */
+    for (size_t i = 0; i < count; i++) {
+      if (states[i] != WAITING)
+        continue;
+      for (size_t dependency : hooks[i].dependencies) {
+        if (states[dependency] == SKIPPED) {
+          Logger::logf(Logger::ERROR, "skipping hook \"%s\", a hook it's after failed",
+                       hooks[i].name.empty() ? hooks[i].get_command().c_str() : hooks[i].name.c_str());
+          states[i] = SKIPPED;
+          finished++;
+          i = -1; /* its own dependents may come before it */
+          break;
+        }
+      }
+    }
+
+    /* spawn the ready hooks on the longest chains, the later ones first on ties, */
+    /* as long as the jobserver has slots for them */
+    bool slot_wanted = false;
+    for (;;) {
+      size_t best = count;
+      for (size_t i = count; i-- > 0;) {
+        if (states[i] != WAITING)
+          continue;
+        bool ready = true;
+        for (size_t dependency : hooks[i].dependencies)
+          ready &= states[dependency] == DONE;
+        if (ready && (best == count || chain[i] > chain[best]))
+          best = i;
+      }
+      if (best == count)
+        break;
+      if (running.empty()) {
+        /* nothing of ours to wait for instead */
+        slots[best] = Jobserver::acquire();
+      } else if (!Jobserver::try_acquire(slots[best])) {
+        slot_wanted = true;
+        break;
+      }
+      states[best] = RUNNING;
+      hooks[best].run();
+      running.push_back(&hooks[best]);
+    }
+    if (running.empty())
+      break;
 
-  return status > 0;
+    /* sleep until one of them exits, or a slot may have come free */
+    std::vector<Subprocess *> processes;
+    for (SystemCommand *hook : running) {
+      processes.push_back(&hook->get_process());
+    }
+    Subprocess::wait_any(processes, slot_wanted ? Jobserver::get_fd() : -1);
+
+    for (size_t i = 0; i < running.size(); i++) {
+      if (running[i]->has_exited()) {
+        size_t index = running[i] - hooks.data();
+        bool hook_failed = running[i]->wait() != 0;
+        Jobserver::release(slots[index]);
+        failed |= hook_failed;
+        states[index] = hook_failed ? SKIPPED : DONE;
+        finished++;
+        this->hook_durations.emplace_back(running[i]->key, running[i]->get_duration());
+        running.erase(running.begin() + i--);
+      }
+    }
+  }
+
+  return failed;
 }
 
-bool Target::run_before_hooks() {
-  return Target::run_hooks(this->before_hooks);
+bool Target::has_exclusive_hook(bool end) {
+  for (SystemCommand &hook : end ? this->end_hooks : this->before_hooks) {
+    if (hook.exclusive)
+      return true;
+  }
+  return false;
 }
 
-bool Target::run_end_hooks() { return Target::run_hooks(this->end_hooks); }
+bool Target::run_before_hooks(const std::function<double(const std::string &)> &predict) {
+  return this->run_hooks(this->before_hooks, predict);
+}
+
+bool Target::run_end_hooks(const std::function<double(const std::string &)> &predict) {
+  return this->run_hooks(this->end_hooks, predict);
+}
+
+std::vector<std::pair<std::string, double>> Target::get_hook_durations() {
+  return this->hook_durations;
+}
 
 bool Target::SystemCommand::has_exited() {
-  int status = 0;
-  waitpid(this->cpid, &status, WNOHANG);
-  return WIFEXITED(status) || WIFSIGNALED(status);
+  if (this->failed)
+    return true;
+  return this->process.has_exited();
 }
 
+Subprocess &Target::SystemCommand::get_process() { return this->process; }
+
+const std::string &Target::SystemCommand::get_command() { return this->command; }
+
+double Target::SystemCommand::get_duration() { return this->duration; }
+
 void Target::SystemCommand::run() {
   this->ran = true;
-  pid_t cpid = fork();
-  if (cpid == 0) {
-    std::exit(system(this->command.c_str()));
-  } else if (cpid == -1) {
-    Logger::logf(Logger::ERROR, "fork failed, can't run hook \"%s\"",
-                 command.c_str());
+  this->started = std::chrono::steady_clock::now();
+  if (this->process.run()) {
+    Logger::logf(Logger::ERROR, "can't run hook \"%s\"", command.c_str());
     this->failed = true;
-  } else {
-    this->cpid = cpid;
   }
 }
 
@@ -556,22 +2173,27 @@ int Target::SystemCommand::wait() {
     this->exit_code = -1;
     return -1;
   }
-  int wstatus = 0;
-  waitpid(this->cpid, &wstatus, 0);
-  if (WIFSIGNALED(wstatus)) {
-    this->exit_code = WTERMSIG(wstatus);
-    return this->exit_code;
+  this->exit_code = this->process.join();
+  if (this->exit_code == -1) {
+    this->failed = true;
+    return -1;
   }
-  if (WIFEXITED(wstatus)) {
-    this->exit_code = WEXITSTATUS(wstatus);
-    return this->exit_code;
+  this->exited = true;
+  this->duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->started).count();
+  if (this->process.get_kill_signal() != 0) {
+    this->exit_code = this->process.get_kill_signal();
   }
-  /* something weird is happening */
-  this->failed = true;
-  this->exit_code = -1;
-  return -1;
+  return this->exit_code;
 }
 
-Target::SystemCommand::SystemCommand(const std::string &command) {
+Target::SystemCommand::SystemCommand(
+    const std::string &command,
+    const std::vector<std::pair<std::string, std::string>> &environment) {
   this->command = command;
+  this->process.set_executable("/bin/sh");
+  this->process.add_argument("-c");
+  this->process.add_argument(command);
+  for (auto &var : environment) {
+    this->process.set_environment(var.first, var.second);
+  }
 }
@@ -23,11 +23,30 @@
 
 #pragma once
 
+#include "catalog/catalog.hpp"
+#include "claims/claims.hpp"
+#include "compress/compress.hpp"
+#include "cpubudget/cpubudget.hpp"
+#include "delta/delta.hpp"
+#include "exclude/exclude.hpp"
+#include "pagecache/pagecache.hpp"
 #include "parser/parser.hpp"
+#include "sink/sink.hpp"
+#include "snapshot/snapshot.hpp"
+#include "subprocess/subprocess.hpp"
+#include "stream/stream.hpp"
+#include "walker/ignore.hpp"
+#include "walker/members.hpp"
+#include "walker/walker.hpp"
 
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <sys/types.h>
+#include <thread>
 #include <vector>
 
 class Target {
@@ -39,57 +58,210 @@ class Target {
   void                  run_main();
   void                  wait_main();
   bool                  has_exited();
-  bool                  run_before_hooks();
-  bool                  run_end_hooks();
+  /* `predict` gives a hook's duration in seconds from its key (-1 if unknown), */
+  /* the hooks on the longest chain of `after`s are started first */
+  bool                  run_before_hooks(const std::function<double(const std::string &)> &predict = nullptr);
+  bool                  run_end_hooks(const std::function<double(const std::string &)> &predict = nullptr);
+  /* whether a before (or end) hook may not overlap anything else being run */
+  bool                  has_exclusive_hook(bool end);
+  /* the key and duration of every hook the last run_*_hooks() ran */
+  std::vector<std::pair<std::string, double>> get_hook_durations();
+  /* adds a [hook] section's hook, resolve_hooks() must be called once all are added */
+  void                  add_hook(INI_Parser::INI_Section hook_config);
+  /* checks the hooks' names and `after`s, exits on unknown names or cycles */
+  void                  resolve_hooks();
   void                  set_passphrase();
   bool                  is_encrypted();
   std::string           get_name();
   std::filesystem::path get_path();
+  /* empty unless the target archives a command's output instead of path */
+  std::string           get_source_command();
+  std::filesystem::path get_destdir();
+  /* a walker over what tar would archive, excludes and ignore rules applied */
+  Walker                make_walker();
+  std::string           get_compress_program();
+  void                  set_compress_program(const std::string &compress_program);
+  /* true if compress_program wasn't set in the config, so backman may pick one */
+  bool                  has_default_compress_program();
+  /* size of the uncompressed tar stream, valid after wait_main() */
+  uint64_t              get_bytes_in();
+  /* size of the archive, valid after wait_main() */
+  uint64_t              get_bytes_out();
+  /* switches compress_program to its fastest level, false if it's unknown or already done */
+  bool                  lower_compression();
+  bool                  is_compression_lowered();
+  /* tracks the target's inodes in `claims`, shared with the run's other targets */
+  void                  set_claims(std::shared_ptr<InodeClaims> claims);
+  /* takes the threads of its compressors and gpg from `budget`, shared with the run's other targets */
+  void                  set_cpu_budget(std::shared_ptr<CpuBudget> budget);
+  /* merges the newest delta archive's chain into a full delta that replaces it */
+  /* reads only the archives, false on error */
+  /* unless `named`, a target without delta archives is skipped rather than an error */
+  bool                  consolidate(bool named);
+  /* rewrites the archives older than recompress_after days at recompress_level */
+  /* verifying each before it replaces the old one, false on error */
+  bool                  recompress();
 
+  /* a hook, run as `/bin/sh -c command` */
   class SystemCommand {
     public:
-    SystemCommand(const std::string &command);
+    SystemCommand(const std::string &command, const std::vector<std::pair<std::string, std::string>> &environment);
 
     void run();
     /* returns -1 internal error, otherwise returns the exit code of the command */
     int  wait();
     bool has_exited();
+    Subprocess &get_process();
+    const std::string &get_command();
+    /* seconds from run() to the exit seen by wait() */
+    double get_duration();
+
+    /* empty for before_hook and end_hook lines, which nothing can come after */
+    std::string              name;
+    /* the names of the hooks of the same phase it runs after */
+    std::vector<std::string> after;
+    /* nothing else (other targets or their hooks) runs while its phase does */
+    bool                     exclusive = false;
+    /* `after` as indices, filled in by resolve_hooks() */
+    std::vector<size_t>      dependencies;
+    /* "before:" or "end:" and the name, or a hash of the command without one, */
+    /* what its durations are recorded under */
+    std::string              key;
 
     private:
-    bool         failed = false; /* error other than command (fork failed) */
+    bool         failed = false; /* error other than command (spawn failed) */
     bool            ran = false;
     bool         exited = false;
     int       exit_code = 0;
-    pid_t          cpid = -1;
+    Subprocess  process;
     std::string command = "";
+    std::chrono::steady_clock::time_point started;
+    double      duration = 0;
   };
 
   private:
   std::filesystem::path              path;
+  /* archived instead of path: the command's stdout, straight into the compressor */
+  std::string                        source_command;
+  std::string                        source_extension;
   bool                               elavated;
   std::string                        name;
   std::filesystem::path              destdir;
   std::filesystem::path              destfile;
+  /* further dests, each gets a copy of the same archive */
+  std::vector<std::filesystem::path> mirror_destdirs;
+  /* false when the archive only goes to dest_commands */
+  bool                               local_archive = true;
+  std::vector<std::string>           dest_commands;
+  uint64_t                           dest_command_part_size;
+  unsigned                           dest_command_parallel;
   std::string                        compress_program;
+  bool                               default_compress_program = false;
   bool                               encrypt;
   bool                               one_file_system;
   std::string                        passphrase;
   std::vector<SystemCommand>         before_hooks;
   std::vector<SystemCommand>         end_hooks;
+  std::vector<std::pair<std::string, std::string>> hook_environment;
+  std::vector<std::pair<std::string, double>>      hook_durations;
   std::vector<std::filesystem::path> excludes;
-  std::vector<pid_t>                 children;
-  struct ProcExitStatusSimple {
-    int    code = -1;
-    bool exited = false;
-    bool failed = false;
+  ExcludeMatcher                     exclude_matcher;
+  std::vector<Subprocess>            children;
+
+  /* one tar (or source_command) | compressor [| gpg] pipeline and the archive it writes */
+  struct Stream {
+    std::filesystem::path                     destfile;
+    std::unique_ptr<Pump>                     input_pump;
+    std::unique_ptr<Pump>                     output_pump;
+    std::vector<std::unique_ptr<CommandSink>> command_sinks;
+    std::unique_ptr<Fanout>                   output_fanout;
+    std::unique_ptr<CacheFollower>            cache_follower;
+    /* writes the stream in place of a head process */
+    std::thread                               producer;
+    bool                                      produced = false;
+    bool                                      delta = false;
+    /* writing the archive out failed, set by wait_streams() */
+    bool                                      failed = false;
+    /* the head's index in children, -1 without one */
+    int                                       head_child = -1;
   };
-  std::vector<ProcExitStatusSimple>  children_status;
+  std::vector<std::unique_ptr<Stream>> streams;
+  uint64_t                           bytes_in = 0;
+  uint64_t                           bytes_out = 0;
+  bool                               compression_lowered = false;
   std::string                        elavate_program;
+  bool                               dictionary;
+  MemberList::Order                  order;
+  bool                               sparse;
+  bool                               cache_hygiene;
+  /* the number of archives the tree is split into, made at the same time */
+  unsigned                           shards;
+  bool                               ignore_files;
+  bool                               exclude_caches;
+  std::vector<std::string>           cache_patterns;
+  /* the rules of the walk in progress */
+  std::unique_ptr<IgnoreRules>       ignore_rules;
+  /* files at least this big are archived as deltas (0 for never) */
+  uint64_t                           delta_min_size;
+  std::filesystem::path              deltafile;
+  std::unique_ptr<DeltaWriter>       delta;
+  std::shared_ptr<InodeClaims>       claims;
+  unsigned                           claims_owner = 0;
+  std::shared_ptr<CpuBudget>         cpu_budget;
+  /* the threads taken from cpu_budget by the run in progress */
+  int                                cpu_share = 0;
+  /* what the walk archived, for the catalog once the archive is whole */
+  std::vector<Catalog::Member>       catalog_members;
+  /* the same for the delta archive */
+  std::vector<Catalog::Member>       catalog_delta_members;
+  /* the level --recompress rewrites old archives at (0 for never), and their age in days */
+  int                                recompress_level;
+  unsigned                           recompress_after;
+  /* output = snapshot, destfile is then the day's directory */
+  bool                               snapshot;
 
   std::vector<std::string>           tar_flags;
 
-  static bool run_hooks(std::vector<SystemCommand> hooks);
-  std::string get_file_name();
+  bool run_hooks(std::vector<SystemCommand> &hooks,
+                 const std::function<double(const std::string &)> &predict);
+  /* takes this run's share of cpu_budget, returns how many of `streams` it has threads for */
+  size_t acquire_cpu_share(size_t streams);
+  /* splits the share between `streams` compressors */
+  void apply_cpu_share(Compressor &compress, size_t streams);
+  static void resolve_hooks(std::vector<SystemCommand> &hooks, const char *phase);
+  /* whether the walk leaves out ignored files or cache directories' contents */
+  bool prunes();
+  /* `shard` is the shard's number when the target is sharded, -1 otherwise */
+  /* `extension` replaces .tar (or source_extension) if given */
+  std::string get_file_name(int shard = -1, const std::string &extension = "");
+  /* today, as it appears in file names */
+  std::string get_date();
+  /* copies the tree into destdir/name/<date>, in place of the archive streams */
+  void run_snapshot();
+  /* `listed` makes tar read its members from `list_fd`, otherwise `list_fd` holds */
+  /* the excludes, or is -1 to pass them as arguments */
+  Subprocess make_tar(bool listed, int list_fd);
+  Subprocess make_source();
+  /* runs `head` into the compressor [and gpg] and on to destfile, adding a stream */
+  /* without a head, `produce` writes the stream to the fd it's given on a thread */
+  /* `list_fd` is closed once it's handed to `head`, `members` are followed through */
+  /* the page cache if given */
+  void start_stream(Subprocess *head, std::function<bool(int)> produce,
+                    Compressor &compress, const std::filesystem::path &destfile,
+                    int list_fd, const std::vector<MemberList::Member> *members);
+  /* the streams started for the tree's shards, not counting the delta stream */
+  size_t shard_streams();
+  void write_manifest();
+  /* joins the streams and sums their bytes, once their heads have exited */
+  void wait_streams();
+  /* writes `produce`'s stream over `archive` in every dest once it's whole and */
+  /* `verify` (if given) accepts it, false otherwise, leaving `archive` as it was */
+  bool replace_archive(const std::filesystem::path &archive, Compressor &compress,
+                       std::function<bool(int)> produce,
+                       std::function<bool(const std::filesystem::path &)> verify);
+  /* starts `archive` [| gpg] | decompressor into `readers`, returns the fd to read */
+  /* it from or -1 */
+  int read_archive(const std::filesystem::path &archive, std::vector<Subprocess> &readers);
 
   static std::string global_pw;
   static bool has_gotten_pw;
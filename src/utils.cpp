@@ -92,6 +92,13 @@ std::filesystem::path resolve_path_with_environment(const std::string& path) {
 }
 
 
+std::filesystem::path state_directory() {
+  if (std::getenv("XDG_STATE_HOME") == NULL)
+    return resolve_path_with_environment("$HOME/.local/state/backman");
+  return resolve_path_with_environment("$XDG_STATE_HOME/backman");
+}
+
+
 bool getline_noecho(std::istream& in, std::string& out) {
     if (!isatty(STDIN_FILENO))
         return static_cast<bool>(std::getline(in, out));
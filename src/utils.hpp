@@ -23,8 +23,11 @@
 
 #pragma once
 
+#include "claims/claims.hpp"
 #include "parser/parser.hpp"
+#include "log/log.h"
 
+#include <ctime>
 #include <vector>
 #include <filesystem>
 
@@ -39,6 +42,19 @@ struct Options {
   std::vector<std::string>  targets;
   bool             generate_example = false;
   bool                same_password = false;
+  bool             use_config_cache = true;
+  Logger::LOGFORMAT      log_format = Logger::LOGFORMAT_TEXT;
+  int                   target_jobs = 1;
+  time_t                   deadline = 0; /* 0 for none */
+  bool                      calibrate = false;
+  InodeClaims::Mode           overlap = InodeClaims::NONE;
+  std::filesystem::path   apply_delta = "";
+  bool                    consolidate = false;
+  bool                     recompress = false;
+  bool                        catalog = false;
+  std::string                    find = "";
+  std::string                 history = "";
+  int                      cpu_budget = 0; /* 0 for no budget */
 };
 
 extern Options options;
@@ -47,4 +63,7 @@ extern INI_Parser::INI_Data parsed_config;
 
 std::filesystem::path resolve_path_with_environment(const std::string &path);
 
+/* $XDG_STATE_HOME/backman, where backman keeps what it learns between runs */
+std::filesystem::path state_directory();
+
 bool getline_noecho(std::istream &in, std::string &out);
@@ -0,0 +1,188 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "walker/ignore.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+/* https://bford.info/cachedir/ */
+static const char cachedir_signature[] = "Signature: 8a477f597d28d172789f06886806bc55";
+
+static std::vector<std::string> split_components(const std::string &path) {
+  std::vector<std::string> components;
+  size_t start = 0;
+  for (;;) {
+    size_t end = path.find('/', start);
+    components.push_back(path.substr(start, end - start));
+    if (end == std::string::npos)
+      return components;
+    start = end + 1;
+  }
+}
+
+/* reads at most `limit` bytes of `name` in the directory `fd`, false if it isn't a file */
+static bool read_file_at(int fd, const char *name, size_t limit, std::string &contents) {
+  int file = openat(fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (file == -1)
+    return false;
+  contents.clear();
+  char buffer[4096];
+  while (contents.size() < limit) {
+    ssize_t n = read(file, buffer, std::min(sizeof(buffer), limit - contents.size()));
+    if (n <= 0)
+      break;
+    contents.append(buffer, n);
+  }
+  close(file);
+  return true;
+}
+
+IgnoreRules::IgnoreRules(bool ignore_files, bool exclude_caches,
+                         const std::vector<std::string> &cache_patterns)
+    : ignore_files(ignore_files), exclude_caches(exclude_caches),
+      cache_patterns(cache_patterns) {}
+
+void IgnoreRules::attach(Walker &walker) {
+  walker.set_filter([this](const Walker::Entry &entry) {
+    return !this->ignored(entry);
+  });
+  walker.set_directory_callbacks(
+      [this](const std::string &path, int fd) { return this->enter(path, fd); },
+      [this](const std::string &path) { this->leave(path); });
+}
+
+bool IgnoreRules::enter(const std::string &path, int fd) {
+  if (this->cache_patterns.matches(path)) {
+    Logger::logf(Logger::DEBUG, "leaving out the contents of \"%s\" (cache_pattern)", path.c_str());
+    return false;
+  }
+  std::string contents;
+  if (this->exclude_caches &&
+      read_file_at(fd, "CACHEDIR.TAG", sizeof(cachedir_signature) - 1, contents) &&
+      contents == cachedir_signature) {
+    Logger::logf(Logger::DEBUG, "leaving out the contents of \"%s\" (CACHEDIR.TAG)", path.c_str());
+    return false;
+  }
+  if (this->ignore_files) {
+    Frame frame{path, {}};
+    /* the directory's own entries are relative to it */
+    if (frame.path.empty() || frame.path.back() != '/')
+      frame.path += '/';
+    if (read_file_at(fd, ".backmanignore", 1 << 20, contents))
+      frame.rules = parse(contents);
+    this->frames.push_back(std::move(frame));
+  }
+  return true;
+}
+
+void IgnoreRules::leave(const std::string &path) {
+  (void)path;
+  if (this->ignore_files)
+    this->frames.pop_back();
+}
+
+bool IgnoreRules::ignored(const Walker::Entry &entry) const {
+  bool is_dir = S_ISDIR(entry.st.st_mode);
+  /* deeper files override shallower ones, later rules override earlier ones */
+  for (auto frame = this->frames.rbegin(); frame != this->frames.rend(); frame++) {
+    if (frame->rules.empty() || entry.path.compare(0, frame->path.size(), frame->path) != 0)
+      continue;
+    std::vector<std::string> components = split_components(entry.path.substr(frame->path.size()));
+    for (auto rule = frame->rules.rbegin(); rule != frame->rules.rend(); rule++) {
+      if (match(*rule, components, is_dir))
+        return !rule->negated;
+    }
+  }
+  return false;
+}
+
+std::vector<IgnoreRules::Rule> IgnoreRules::parse(const std::string &text) {
+  std::vector<Rule> rules;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos)
+      end = text.size();
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    /* trailing spaces don't count unless escaped */
+    while (!line.empty() && line.back() == ' ' &&
+           !(line.size() > 1 && line[line.size() - 2] == '\\'))
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    Rule rule{{}, false, false, false};
+    if (line[0] == '!') {
+      rule.negated = true;
+      line.erase(0, 1);
+    }
+    if (!line.empty() && line.back() == '/') {
+      rule.dir_only = true;
+      line.pop_back();
+    }
+    if (line.find('/') != std::string::npos) {
+      rule.anchored = true;
+      if (line[0] == '/')
+        line.erase(0, 1);
+    }
+    if (line.empty())
+      continue;
+    rule.components = split_components(line);
+    rules.push_back(std::move(rule));
+  }
+  return rules;
+}
+
+static bool match_components(const std::vector<std::string> &pattern, size_t p,
+                             const std::vector<std::string> &path, size_t i) {
+  if (p == pattern.size())
+    return i == path.size();
+  if (pattern[p] == "**") {
+    /* a trailing ** is everything inside, not the directory itself */
+    if (p + 1 == pattern.size())
+      return i < path.size();
+    for (size_t j = i; j <= path.size(); j++) {
+      if (match_components(pattern, p + 1, path, j))
+        return true;
+    }
+    return false;
+  }
+  return i < path.size() && fnmatch(pattern[p].c_str(), path[i].c_str(), 0) == 0 &&
+         match_components(pattern, p + 1, path, i + 1);
+}
+
+bool IgnoreRules::match(const Rule &rule, const std::vector<std::string> &components, bool is_dir) {
+  if (rule.dir_only && !is_dir)
+    return false;
+  if (!rule.anchored)
+    return fnmatch(rule.components[0].c_str(), components.back().c_str(), 0) == 0;
+  return match_components(rule.components, 0, components, 0);
+}
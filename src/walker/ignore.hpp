@@ -0,0 +1,68 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "exclude/exclude.hpp"
+#include "walker/walker.hpp"
+
+#include <string>
+#include <vector>
+
+/* what the walker leaves out as it descends: whatever .backmanignore files say (with */
+/* gitignore's rules) and the contents of cache directories, which are kept empty */
+class IgnoreRules {
+  public:
+  IgnoreRules(bool ignore_files, bool exclude_caches,
+              const std::vector<std::string> &cache_patterns);
+
+  /* sets the walker's filter and directory callbacks, the rules must outlive the walk */
+  void attach(Walker &walker);
+
+  /* reads the directory's .backmanignore, returns false if it is a cache directory */
+  bool enter(const std::string &path, int fd);
+  void leave(const std::string &path);
+  /* whether the innermost .backmanignore with a rule matching `entry` ignores it */
+  bool ignored(const Walker::Entry &entry) const;
+
+  private:
+  struct Rule {
+    std::vector<std::string> components; /* fnmatch patterns, "**" matches any number */
+    bool                     negated;    /* started with !, re-includes */
+    bool                     dir_only;   /* ended with /, only matches directories */
+    bool                     anchored;   /* had a / before the end, matches from the file's directory */
+  };
+  /* a directory being walked and the rules of its .backmanignore */
+  struct Frame {
+    std::string       path;
+    std::vector<Rule> rules;
+  };
+
+  bool                ignore_files;
+  bool                exclude_caches;
+  ExcludeMatcher      cache_patterns;
+  std::vector<Frame>  frames;
+
+  static std::vector<Rule> parse(const std::string &text);
+  static bool              match(const Rule &rule, const std::vector<std::string> &components, bool is_dir);
+};
@@ -0,0 +1,196 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "walker/members.hpp"
+#include "log/log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <map>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool MemberList::parse_order(const std::string &name, Order &order) {
+  if (name == "none")
+    order = NONE;
+  else if (name == "type")
+    order = TYPE;
+  else if (name == "inode")
+    order = INODE;
+  else if (name == "extent")
+    order = EXTENT;
+  else
+    return false;
+  return true;
+}
+
+MemberList::MemberList(Order order) : order(order) {}
+
+uint64_t MemberList::first_extent(const Walker::Entry &entry) {
+  int fd = openat(entry.dirfd, entry.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOATIME);
+  if (fd == -1)
+    fd = openat(entry.dirfd, entry.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+  /* room for a single extent */
+  union {
+    struct fiemap map;
+    char          buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.map.fm_length = FIEMAP_MAX_OFFSET;
+  request.map.fm_extent_count = 1;
+  uint64_t physical = 0;
+  if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0)
+    physical = request.map.fm_extents[0].fe_physical;
+  close(fd);
+  return physical;
+}
+
+void MemberList::add(const Walker::Entry &entry) {
+  Member member;
+  member.path = entry.path;
+  member.size = entry.st.st_size;
+  member.allocated = (off_t)entry.st.st_blocks * 512;
+  member.dev = entry.st.st_dev;
+  member.ino = entry.st.st_ino;
+  member.nlink = entry.st.st_nlink;
+  member.physical = 0;
+  if (S_ISDIR(entry.st.st_mode)) {
+    member.group = 0;
+  } else if (S_ISREG(entry.st.st_mode)) {
+    member.group = 1;
+    if (this->order == TYPE) {
+      const char *dot = strrchr(entry.name, '.');
+      /* dotfiles have no extension */
+      if (dot != NULL && dot != entry.name) {
+        member.extension = dot + 1;
+        std::transform(member.extension.begin(), member.extension.end(), member.extension.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+      }
+    } else if (this->order == EXTENT) {
+      member.physical = first_extent(entry);
+    }
+  } else {
+    member.group = 2;
+  }
+  this->members.push_back(std::move(member));
+}
+
+void MemberList::sort() {
+  /* stable, so directories and whatever ties stay in walk order */
+  std::stable_sort(this->members.begin(), this->members.end(), [this](const Member &a, const Member &b) {
+    if (a.group != b.group)
+      return a.group < b.group;
+    if (a.group != 1)
+      return false;
+    switch (this->order) {
+      case TYPE:
+        if (a.extension != b.extension)
+          return a.extension < b.extension;
+        return a.size < b.size;
+      case INODE:
+        if (a.dev != b.dev)
+          return a.dev < b.dev;
+        return a.ino < b.ino;
+      case EXTENT:
+        if (a.dev != b.dev)
+          return a.dev < b.dev;
+        return a.physical < b.physical;
+      default:
+        return false;
+    }
+  });
+}
+
+const std::vector<MemberList::Member> &MemberList::get_members() {
+  return this->members;
+}
+
+std::vector<MemberList> MemberList::split(size_t count, bool sparse) {
+  std::vector<MemberList> lists(count, MemberList(this->order));
+  std::vector<uint64_t> loads(count, 0);
+  std::map<std::pair<dev_t, ino_t>, size_t> linked;
+  for (const Member &member : this->members) {
+    size_t list = 0;
+    if (member.group == 1) {
+      auto link = linked.find({member.dev, member.ino});
+      if (link != linked.end()) {
+        list = link->second;
+      } else {
+        /* each file goes to the list with the least to do so far, which keeps */
+        /* every list in order */
+        list = std::min_element(loads.begin(), loads.end()) - loads.begin();
+        if (member.nlink > 1)
+          linked[{member.dev, member.ino}] = list;
+      }
+      off_t stored = sparse && member.allocated < member.size ? member.allocated : member.size;
+      /* a header's worth for every file, so many small files weigh something */
+      loads[list] += stored + 1536;
+    }
+    lists[list].members.push_back(member);
+  }
+  return lists;
+}
+
+size_t MemberList::size() {
+  return this->members.size();
+}
+
+int MemberList::to_memfd() {
+  int fd = memfd_create("backman-members", MFD_CLOEXEC);
+  if (fd == -1) {
+    Logger::logf(Logger::ERROR, "memfd_create() failed: %s", strerror(errno));
+    return -1;
+  }
+  std::string buffer;
+  for (const Member &member : this->members) {
+    buffer += member.path;
+    buffer += '\0';
+    if (buffer.size() >= (1 << 20) || &member == &this->members.back()) {
+      const char *data = buffer.data();
+      size_t left = buffer.size();
+      while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written == -1) {
+          if (errno == EINTR)
+            continue;
+          Logger::logf(Logger::ERROR, "writing the member list failed: %s", strerror(errno));
+          close(fd);
+          return -1;
+        }
+        data += written;
+        left -= written;
+      }
+      buffer.clear();
+    }
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
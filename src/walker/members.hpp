@@ -0,0 +1,80 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include "walker/walker.hpp"
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/* the members of an archive in the order tar should write them */
+/* tar writes what it's given in readdir order, which scatters similar files over the */
+/* stream, beyond the compressor's window */
+class MemberList {
+  public:
+  enum Order {
+    NONE,   /* walk order */
+    TYPE,   /* files grouped by extension then size, so similar content is close together */
+    INODE,  /* files by inode number, roughly their order on disk */
+    EXTENT, /* files by the physical offset of their first extent, for rotational disks */
+  };
+
+  struct Member {
+    std::string path;
+    int         group;     /* directories, then files, then everything else */
+    std::string extension;
+    off_t       size;
+    off_t       allocated; /* bytes on disk, less than size for sparse files */
+    dev_t       dev;
+    ino_t       ino;
+    nlink_t     nlink;
+    uint64_t    physical;
+  };
+
+  /* false if `name` isn't an order */
+  static bool parse_order(const std::string &name, Order &order);
+
+  MemberList(Order order);
+
+  /* feed it every entry of the target's walk */
+  void   add(const Walker::Entry &entry);
+  /* puts the members in order, directories first so they exist before what's in them */
+  void   sort();
+  size_t size();
+  /* returns a memfd holding the NUL separated list for `tar --null -T`, or -1 */
+  int    to_memfd();
+  const std::vector<Member> &get_members();
+  /* splits the sorted list into `count` lists that take tar about as long each, keeping */
+  /* their order; hard links stay together so tar still links them, and every */
+  /* directory and non-file goes to the first list */
+  std::vector<MemberList> split(size_t count, bool sparse);
+
+  private:
+  Order               order;
+  std::vector<Member> members;
+
+  static uint64_t first_extent(const Walker::Entry &entry);
+};
@@ -0,0 +1,135 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "walker/walker.hpp"
+#include "log/log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+Walker::Walker(std::filesystem::path root, bool one_file_system)
+    : root(root), one_file_system(one_file_system) {}
+
+void Walker::set_filter(std::function<bool(const Entry &)> filter) {
+  this->filter = filter;
+}
+
+void Walker::set_path_filter(std::function<bool(const std::string &)> path_filter) {
+  this->path_filter = path_filter;
+}
+
+void Walker::set_directory_callbacks(std::function<bool(const std::string &, int)> enter,
+                                     std::function<void(const std::string &)> leave) {
+  this->enter = enter;
+  this->leave = leave;
+}
+
+void Walker::walk(const std::function<void(const Entry &)> &visit) {
+  Entry entry;
+  entry.path = this->root.string();
+  entry.dirfd = AT_FDCWD;
+  entry.name = entry.path.c_str();
+  this->stopped = false;
+  if (this->path_filter && !this->path_filter(entry.path))
+    return;
+  if (fstatat(AT_FDCWD, entry.path.c_str(), &entry.st, AT_SYMLINK_NOFOLLOW) == -1) {
+    Logger::logf(Logger::WARN, "can't stat \"%s\": %s", entry.path.c_str(), strerror(errno));
+    return;
+  }
+  this->root_dev = entry.st.st_dev;
+
+  if (this->filter && !this->filter(entry))
+    return;
+  visit(entry);
+
+  if (!S_ISDIR(entry.st.st_mode) || this->stopped)
+    return;
+  int fd = open(entry.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    Logger::logf(Logger::WARN, "can't open \"%s\": %s", entry.path.c_str(), strerror(errno));
+    return;
+  }
+  this->walk_directory(fd, entry.path, visit);
+}
+
+void Walker::walk_directory(int dirfd, const std::string &path, const std::function<void(const Entry &)> &visit) {
+  DIR *dir = fdopendir(dirfd);
+  if (dir == NULL) {
+    close(dirfd);
+    return;
+  }
+
+  if (this->enter && !this->enter(path, dirfd)) {
+    closedir(dir);
+    return;
+  }
+
+  std::string prefix = path;
+  if (prefix.empty() || prefix.back() != '/')
+    prefix += '/';
+
+  errno = 0;
+  while (struct dirent *ent = this->stopped ? NULL : readdir(dir)) {
+    if (std::strcmp(ent->d_name, ".") == 0 || std::strcmp(ent->d_name, "..") == 0)
+      continue;
+
+    Entry entry;
+    entry.path = prefix + ent->d_name;
+    entry.dirfd = dirfd;
+    entry.name = ent->d_name;
+    if (this->path_filter && !this->path_filter(entry.path))
+      continue;
+    if (fstatat(dirfd, ent->d_name, &entry.st, AT_SYMLINK_NOFOLLOW) == -1) {
+      Logger::logf(Logger::WARN, "can't stat \"%s\": %s", entry.path.c_str(), strerror(errno));
+      continue;
+    }
+
+    if (this->filter && !this->filter(entry))
+      continue;
+    visit(entry);
+    if (this->stopped)
+      break;
+
+    /* like tar --one-file-system, mount points themselves are kept but not entered */
+    if (!S_ISDIR(entry.st.st_mode) || (this->one_file_system && entry.st.st_dev != this->root_dev))
+      continue;
+
+    int fd = openat(dirfd, ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+      Logger::logf(Logger::WARN, "can't open \"%s\": %s", entry.path.c_str(), strerror(errno));
+      continue;
+    }
+    this->walk_directory(fd, entry.path, visit);
+  }
+
+  closedir(dir);
+  if (this->leave)
+    this->leave(path);
+}
+
+void Walker::stop() {
+  this->stopped = true;
+}
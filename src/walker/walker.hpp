@@ -0,0 +1,71 @@
+/*
+ * Backup manager to make backups using tar with gpg encryption and xz compression
+ * Copyright (C) 2026 N Liam Waaga
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <sys/stat.h>
+
+/* walks a target's tree with openat()/fstatat() the way tar would, so backman can */
+/* see (and choose) what ends up in an archive before tar reads it */
+class Walker {
+  public:
+
+  struct Entry {
+    std::string path;  /* as tar would name it, ie starting with the root as given */
+    struct stat st;    /* lstat() of the entry */
+    int         dirfd; /* the directory containing the entry (for *at() calls), only valid during the callback */
+    const char *name;  /* the entry's name inside dirfd, only valid during the callback */
+  };
+
+  Walker(std::filesystem::path root, bool one_file_system);
+
+  /* return false to skip an entry, and everything under it if it's a directory */
+  void set_filter(std::function<bool(const Entry &)> filter);
+  /* the same by path alone, checked before the entry is stat'ed */
+  void set_path_filter(std::function<bool(const std::string &)> path_filter);
+  /* called with each directory's path and fd before its entries are visited, return */
+  /* false to skip them (the directory itself is kept), and after they were if it didn't */
+  void set_directory_callbacks(std::function<bool(const std::string &, int)> enter,
+                               std::function<void(const std::string &)> leave);
+
+  /* visits the root and everything under it, depth first, in readdir order */
+  /* unreadable directories are logged and skipped */
+  void walk(const std::function<void(const Entry &)> &visit);
+  /* called from `visit`, ends the walk after the current entry */
+  void stop();
+
+  private:
+  std::filesystem::path              root;
+  bool                               one_file_system;
+  dev_t                              root_dev = 0;
+  bool                               stopped = false;
+  std::function<bool(const Entry &)> filter;
+  std::function<bool(const std::string &)> path_filter;
+  std::function<bool(const std::string &, int)> enter;
+  std::function<void(const std::string &)> leave;
+
+  void walk_directory(int dirfd, const std::string &path, const std::function<void(const Entry &)> &visit);
+};